@@ -0,0 +1,269 @@
+/*
+ * bench.c -- helpers shared by the userspace benchmark tools
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <sys/utsname.h>
+
+#include "bench.h"
+
+uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+ * Histograms
+ */
+static int hist_index(uint64_t v)
+{
+	int msb;
+
+	if (v < HIST_SUB)
+		return v;
+	msb = 63 - __builtin_clzll(v);
+	return (msb - HIST_SUB_BITS + 1) * HIST_SUB +
+	       ((v >> (msb - HIST_SUB_BITS)) & (HIST_SUB - 1));
+}
+
+/* The smallest value that lands in bucket i */
+static uint64_t hist_value(int i)
+{
+	int msb;
+
+	if (i < HIST_SUB)
+		return i;
+	msb = i / HIST_SUB + HIST_SUB_BITS - 1;
+	return (1ULL << msb) |
+	       ((uint64_t) (i % HIST_SUB) << (msb - HIST_SUB_BITS));
+}
+
+void hist_add(struct hist *h, uint64_t v)
+{
+	h->bucket[hist_index(v)]++;
+	h->count++;
+	h->sum += v;
+	if (v > h->max)
+		h->max = v;
+}
+
+void hist_merge(struct hist *dst, const struct hist *src)
+{
+	int i;
+
+	for (i = 0; i < HIST_BUCKETS; i++)
+		dst->bucket[i] += src->bucket[i];
+	dst->count += src->count;
+	dst->sum += src->sum;
+	if (src->max > dst->max)
+		dst->max = src->max;
+}
+
+uint64_t hist_percentile(const struct hist *h, double p)
+{
+	uint64_t rank, seen = 0;
+	int i;
+
+	if (!h->count)
+		return 0;
+	rank = (uint64_t) (p / 100.0 * h->count);
+	if (rank >= h->count)
+		rank = h->count - 1;
+	for (i = 0; i < HIST_BUCKETS; i++) {
+		seen += h->bucket[i];
+		if (seen > rank)
+			return hist_value(i) < h->max ? hist_value(i) : h->max;
+	}
+	return h->max;
+}
+
+/*
+ * Results, as CSV or as a JSON array of objects
+ */
+static int result_rows;
+
+int out_format_parse(const char *name, enum out_format *fmt)
+{
+	if (!strcmp(name, "csv"))
+		*fmt = OUT_CSV;
+	else if (!strcmp(name, "json"))
+		*fmt = OUT_JSON;
+	else
+		return -1;
+	return 0;
+}
+
+static const char *kernel_release(void)
+{
+	static struct utsname uts;
+
+	if (!uts.release[0] && uname(&uts))
+		return "unknown";
+	return uts.release;
+}
+
+void result_begin(FILE *f, enum out_format fmt)
+{
+	result_rows = 0;
+	if (fmt == OUT_JSON)
+		fprintf(f, "[\n");
+	else
+		fprintf(f, "kernel,workload,op,threads,size,seconds,ops,"
+			"ops_per_s,mb_per_s,lat_mean_ns,lat_p50_ns,lat_p90_ns,"
+			"lat_p99_ns,lat_p999_ns,lat_max_ns,extra\n");
+	fflush(f);
+}
+
+/* Prints "key=value key=value" as JSON members, numbers left unquoted */
+static void json_extra(FILE *f, const char *extra)
+{
+	char *copy, *tok, *save, *val, *end;
+	int first = 1;
+
+	fprintf(f, "{");
+	copy = strdup(extra ? extra : "");
+	for (tok = strtok_r(copy, " ", &save); tok;
+	     tok = strtok_r(NULL, " ", &save)) {
+		val = strchr(tok, '=');
+		if (!val)
+			continue;
+		*val++ = '\0';
+		strtod(val, &end);
+		if (*val && !*end)
+			fprintf(f, "%s\"%s\": %s", first ? "" : ", ", tok, val);
+		else
+			fprintf(f, "%s\"%s\": \"%s\"", first ? "" : ", ", tok,
+				val);
+		first = 0;
+	}
+	free(copy);
+	fprintf(f, "}");
+}
+
+void result_print(FILE *f, enum out_format fmt, const struct result *r)
+{
+	const struct hist *h = r->lat;
+	double secs = r->seconds > 0 ? r->seconds : 1;
+	double mean = h->count ? (double) h->sum / h->count : 0;
+
+	if (fmt == OUT_JSON) {
+		fprintf(f, "%s  {\"kernel\": \"%s\", \"workload\": \"%s\", "
+			"\"op\": \"%s\", \"threads\": %d, \"size\": %zu, "
+			"\"seconds\": %.3f, \"ops\": %llu, "
+			"\"ops_per_s\": %.1f, \"mb_per_s\": %.3f, "
+			"\"lat_ns\": {\"mean\": %.0f, \"p50\": %llu, "
+			"\"p90\": %llu, \"p99\": %llu, \"p999\": %llu, "
+			"\"max\": %llu}, \"extra\": ",
+			result_rows ? ",\n" : "", kernel_release(),
+			r->workload, r->op, r->threads, r->size, r->seconds,
+			(unsigned long long) h->count, h->count / secs,
+			r->bytes / secs / 1e6, mean,
+			(unsigned long long) hist_percentile(h, 50),
+			(unsigned long long) hist_percentile(h, 90),
+			(unsigned long long) hist_percentile(h, 99),
+			(unsigned long long) hist_percentile(h, 99.9),
+			(unsigned long long) h->max);
+		json_extra(f, r->extra);
+		fprintf(f, "}");
+	} else {
+		fprintf(f, "%s,%s,%s,%d,%zu,%.3f,%llu,%.1f,%.3f,%.0f,%llu,"
+			"%llu,%llu,%llu,%llu,%s\n",
+			kernel_release(), r->workload, r->op, r->threads,
+			r->size, r->seconds, (unsigned long long) h->count,
+			h->count / secs, r->bytes / secs / 1e6, mean,
+			(unsigned long long) hist_percentile(h, 50),
+			(unsigned long long) hist_percentile(h, 90),
+			(unsigned long long) hist_percentile(h, 99),
+			(unsigned long long) hist_percentile(h, 99.9),
+			(unsigned long long) h->max,
+			r->extra ? r->extra : "");
+	}
+	result_rows++;
+	fflush(f);
+}
+
+void result_end(FILE *f, enum out_format fmt)
+{
+	if (fmt == OUT_JSON)
+		fprintf(f, "\n]\n");
+	fflush(f);
+}
+
+/*
+ * Module loading, through finit_module(2) so no insmod is needed
+ */
+#define MAX_LOADED	32
+
+static char loaded[MAX_LOADED][64];
+static int nr_loaded;
+
+int module_load(const char *dir, const char *name, const char *params)
+{
+	char path[4096];
+	int fd, ret;
+
+	snprintf(path, sizeof(path), "%s/%s.ko", dir, name);
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		fprintf(stderr, "%s: %s\n", path, strerror(errno));
+		return -1;
+	}
+	ret = syscall(SYS_finit_module, fd, params ? params : "", 0);
+	close(fd);
+
+	if (ret && errno == EEXIST)
+		return 0;	/* somebody else's; leave it loaded */
+	if (ret) {
+		fprintf(stderr, "finit_module %s: %s\n", path,
+			strerror(errno));
+		return -1;
+	}
+	if (nr_loaded < MAX_LOADED)
+		snprintf(loaded[nr_loaded++], sizeof(loaded[0]), "%s", name);
+	return 0;
+}
+
+void module_unload_all(void)
+{
+	while (nr_loaded > 0) {
+		nr_loaded--;
+		if (syscall(SYS_delete_module, loaded[nr_loaded], O_NONBLOCK))
+			fprintf(stderr, "delete_module %s: %s\n",
+				loaded[nr_loaded], strerror(errno));
+	}
+}
+
+/* udev creates the device nodes asynchronously; give it a moment */
+int wait_for_path(const char *path, int timeout_ms)
+{
+	while (access(path, F_OK)) {
+		if (timeout_ms <= 0)
+			return -1;
+		usleep(10000);
+		timeout_ms -= 10;
+	}
+	return 0;
+}
+
+int pin_to_cpu(int cpu)
+{
+	cpu_set_t set;
+
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	return sched_setaffinity(0, sizeof(set), &set);
+}
@@ -0,0 +1,60 @@
+/*
+ * bench.h -- helpers shared by the userspace benchmark tools
+ *
+ * Latencies are kept in log-linear histograms: every power of two is split
+ * into HIST_SUB buckets, so percentiles are exact to about 6%.
+ */
+
+#ifndef _BENCH_H
+#define _BENCH_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#define HIST_SUB_BITS	4
+#define HIST_SUB	(1 << HIST_SUB_BITS)
+#define HIST_BUCKETS	(64 * HIST_SUB)
+
+struct hist {
+	uint64_t count;
+	uint64_t sum;
+	uint64_t max;
+	uint64_t bucket[HIST_BUCKETS];
+};
+
+uint64_t now_ns(void);
+void hist_add(struct hist *h, uint64_t v);
+void hist_merge(struct hist *dst, const struct hist *src);
+uint64_t hist_percentile(const struct hist *h, double p);
+
+/* One row of results: a workload, one of its operations, and its latency */
+struct result {
+	const char *workload;
+	const char *op;
+	int threads;
+	size_t size;		/* bytes per operation */
+	double seconds;
+	uint64_t bytes;
+	const struct hist *lat;	/* one sample per operation, in ns */
+	const char *extra;	/* "key=value key=value", or NULL */
+};
+
+enum out_format {
+	OUT_CSV,
+	OUT_JSON
+};
+
+int out_format_parse(const char *name, enum out_format *fmt);
+void result_begin(FILE *f, enum out_format fmt);
+void result_print(FILE *f, enum out_format fmt, const struct result *r);
+void result_end(FILE *f, enum out_format fmt);
+
+/* Modules loaded through module_load() are unloaded in reverse order */
+int module_load(const char *dir, const char *name, const char *params);
+void module_unload_all(void);
+
+int wait_for_path(const char *path, int timeout_ms);
+int pin_to_cpu(int cpu);
+
+#endif /* _BENCH_H */
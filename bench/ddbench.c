@@ -0,0 +1,436 @@
+/*
+ * ddbench.c -- drive every dd_primer device and /proc file from user space
+ *
+ * For each workload asked for, ddbench optionally loads the modules it
+ * needs (-l), runs `threads` threads against it for `duration` seconds and
+ * prints one result row per operation, as CSV or JSON. Modules are unloaded
+ * again after each workload, so every workload starts from a fresh module.
+ *
+ *	ddbench -l -t 4 -s 4096 -d 5 -f json mynull sleepy jit_busy
+ *
+ * With -n, the character device modules are loaded with that many minors
+ * and thread i works on minor i % n.
+ *
+ * Not every file is a workload. cur_time_bench, cur_time_skew and
+ * vram_bench run a benchmark of their own on each read and print its
+ * table; jitpool only holds counters, jit_load is a background load to run
+ * the others under, and jittimer and friends print lines that aren't in
+ * the jiffies/CPU time form run_jit() reads. Read those directly.
+ *
+ * Must run as root to load modules and open the devices.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "bench.h"
+
+/* The command line */
+static int opt_threads		= 1;
+static size_t opt_size		= 4096;
+static double opt_duration	= 5;
+static int opt_load;
+static const char *opt_moddir	= ".";
+static int opt_delay		= 10;	/* jiffies, for the jit modules */
+static int opt_devices		= 1;	/* minors, for the chrdev modules */
+static enum out_format opt_fmt	= OUT_CSV;
+
+struct workload;
+
+struct worker {
+	const struct workload *wl;
+	int id;
+	pthread_t thread;
+	uint64_t deadline;
+	struct hist lat[2];		/* per operation of the workload */
+	uint64_t bytes[2];
+	/* jit lines */
+	uint64_t jiffies, cpu_us, lines;
+	int error;
+};
+
+struct workload {
+	const char *name;
+	const char *modules[3];		/* to load, in order */
+	const char *params;		/* for the last module */
+	const char *path;		/* "%d" stands for the minor */
+	const char *ops[2];		/* names of the timed operations */
+	void *(*run)(void *arg);
+};
+
+static void worker_fail(struct worker *w, const char *what)
+{
+	fprintf(stderr, "%s: %s: %s\n", w->wl->name, what, strerror(errno));
+	w->error = 1;
+}
+
+/*
+ * Character devices: a write then a read of opt_size bytes at offset 0
+ */
+static void *run_chrdev(void *arg)
+{
+	struct worker *w = arg;
+	char path[64];
+	uint64_t t0, t1;
+	char *buf;
+	ssize_t n;
+	int fd;
+
+	snprintf(path, sizeof(path), w->wl->path, w->id % opt_devices);
+	buf = calloc(1, opt_size);
+	fd = open(path, O_RDWR);
+	if (!buf || fd < 0) {
+		worker_fail(w, path);
+		goto out;
+	}
+	memset(buf, 'a' + w->id % 26, opt_size);
+
+	while ((t0 = now_ns()) < w->deadline) {
+		n = pwrite(fd, buf, opt_size, 0);
+		t1 = now_ns();
+		if (n < 0) {
+			worker_fail(w, "write");
+			break;
+		}
+		hist_add(&w->lat[0], t1 - t0);
+		w->bytes[0] += n;
+
+		n = pread(fd, buf, opt_size, 0);
+		t0 = now_ns();
+		if (n < 0) {
+			worker_fail(w, "read");
+			break;
+		}
+		hist_add(&w->lat[1], t0 - t1);
+		w->bytes[1] += n;
+	}
+out:
+	if (fd >= 0)
+		close(fd);
+	free(buf);
+	return NULL;
+}
+
+/*
+ * sleepy: reader threads block in read() until the waker writes. A write
+ * lets one reader through (the first one up clears the flag), and the
+ * latency is from just before the write to that reader returning.
+ */
+static volatile uint64_t sleepy_stamp;
+static volatile int sleepy_woken;
+static volatile int sleepy_exited;
+static volatile int sleepy_done;
+
+static void *run_sleepy_reader(void *arg)
+{
+	struct worker *w = arg;
+	char c;
+	int fd;
+
+	fd = open(w->wl->path, O_RDONLY);
+	if (fd < 0) {
+		worker_fail(w, w->wl->path);
+		__sync_fetch_and_add(&sleepy_exited, 1);
+		return NULL;
+	}
+	while (!sleepy_done) {
+		if (read(fd, &c, 1) < 0) {
+			worker_fail(w, "read");
+			break;
+		}
+		if (!sleepy_done)
+			hist_add(&w->lat[0], now_ns() - sleepy_stamp);
+		__sync_fetch_and_add(&sleepy_woken, 1);
+	}
+	close(fd);
+	__sync_fetch_and_add(&sleepy_exited, 1);
+	return NULL;
+}
+
+static void *run_sleepy(void *arg)
+{
+	struct worker *w = arg;
+	uint64_t t;
+	int fd;
+
+	if (w->id != 0)
+		return run_sleepy_reader(arg);
+
+	/* worker 0 is the waker; the others read */
+	fd = open(w->wl->path, O_WRONLY);
+	if (fd < 0) {
+		worker_fail(w, w->wl->path);
+		sleepy_done = 1;
+		return NULL;
+	}
+	usleep(10000);		/* let the readers go to sleep */
+	while (now_ns() < w->deadline) {
+		sleepy_woken = 0;
+		sleepy_stamp = now_ns();
+		if (write(fd, "x", 1) < 0) {
+			worker_fail(w, "write");
+			break;
+		}
+		/* wait for the wakeup, but not forever */
+		t = now_ns();
+		while (!sleepy_woken && now_ns() - t < 10000000)
+			sched_yield();
+		usleep(100);	/* and for the reader to block again */
+	}
+	sleepy_done = 1;
+	/* release the readers still waiting */
+	while (sleepy_exited < opt_threads - 1 && write(fd, "x", 1) > 0)
+		usleep(1000);
+	close(fd);
+	return NULL;
+}
+
+/*
+ * jit /proc files: stream lines until the deadline, timing each line and
+ * adding up the jiffies and CPU time each one reports
+ */
+static void *run_jit(void *arg)
+{
+	struct worker *w = arg;
+	char line[256];
+	unsigned long j0, j1, cpu_us;
+	uint64_t t0, t1;
+	FILE *f;
+
+	f = fopen(w->wl->path, "r+");
+	if (!f) {
+		worker_fail(w, w->wl->path);
+		return NULL;
+	}
+	/* stream until we close the file */
+	fputs("0\n", f);
+	fflush(f);
+
+	t0 = now_ns();
+	while (t0 < w->deadline && fgets(line, sizeof(line), f)) {
+		t1 = now_ns();
+		hist_add(&w->lat[0], t1 - t0);
+		w->bytes[0] += strlen(line);
+		t0 = t1;
+		if (sscanf(line, "%lu %lu %lu", &j0, &j1, &cpu_us) == 3) {
+			w->jiffies += j1 - j0;
+			w->cpu_us += cpu_us;
+			w->lines++;
+		}
+	}
+	fclose(f);
+	return NULL;
+}
+
+static const struct workload workloads[] = {
+	{ "mynull",	{ "dd_core", "ofd" }, "num_devices",
+	  "/dev/mynull%d", { "write", "read" }, run_chrdev },
+	{ "kertimer",	{ "dd_core", "kertimer" }, "num_devices",
+	  "/dev/kertimer%d", { "write", "read" }, run_chrdev },
+	{ "vram",	{ "dd_core", "vid_ram_ex" }, "num_devices",
+	  "/dev/vram%d", { "write", "read" }, run_chrdev },
+	{ "sleepy",	{ "dd_core", "sleepy" }, NULL, "/dev/sleepy0",
+	  { "wakeup" }, run_sleepy },
+	{ "jitseq",	{ "dd_core", "jit_stream", "jit" }, "delay",
+	  "/proc/jitseq", { "line" }, run_jit },
+	{ "jit_busy",	{ "dd_core", "jit_stream", "jit_busy" }, "delay",
+	  "/proc/jit_busy", { "line" }, run_jit },
+	{ "jit_sched",	{ "dd_core", "jit_stream", "jit_sched" }, "delay",
+	  "/proc/jit_sched", { "line" }, run_jit },
+	{ "jit_queue",	{ "dd_core", "jit_stream", "jit_queue" }, "delay",
+	  "/proc/jit_queue", { "line" }, run_jit },
+	{ "jit_schedto", { "dd_core", "jit_stream", "jit_schedto" },
+	  "delay", "/proc/jit_schedto", { "line" }, run_jit },
+	{ "cur_time",	{ "dd_core", "jit_stream", "jit_cur_time" }, NULL,
+	  "/proc/cur_time", { "line" }, run_jit },
+};
+
+#define NR_WORKLOADS	(sizeof(workloads) / sizeof(workloads[0]))
+
+static int load_workload(const struct workload *wl)
+{
+	char params[64] = "", path[64];
+	int i;
+
+	if (wl->params && !strcmp(wl->params, "delay"))
+		snprintf(params, sizeof(params), "delay=%d", opt_delay);
+	if (wl->params && !strcmp(wl->params, "num_devices"))
+		snprintf(params, sizeof(params), "num_devices=%d",
+			 opt_devices);
+
+	for (i = 0; i < 3 && wl->modules[i]; i++)
+		if (module_load(opt_moddir, wl->modules[i],
+				i < 2 && wl->modules[i + 1] ? "" : params))
+			return -1;
+
+	/* the last minor comes up last */
+	snprintf(path, sizeof(path), wl->path, opt_devices - 1);
+	return wait_for_path(path, 2000);
+}
+
+static int run_workload(const struct workload *wl)
+{
+	struct worker *workers;
+	struct hist *lat;
+	struct result r;
+	char extra[128];
+	uint64_t start, bytes, jiffies = 0, cpu_us = 0, lines = 0;
+	int i, op, error = 0;
+
+	if (wl->run == run_sleepy && opt_threads < 2) {
+		fprintf(stderr, "sleepy: needs at least 2 threads\n");
+		return -1;
+	}
+	if (opt_load && load_workload(wl)) {
+		module_unload_all();
+		return -1;
+	}
+
+	workers = calloc(opt_threads, sizeof(*workers));
+	lat = calloc(1, sizeof(*lat));
+	if (!workers || !lat) {
+		perror("calloc");
+		exit(1);
+	}
+	sleepy_done = sleepy_woken = sleepy_exited = 0;
+
+	start = now_ns();
+	for (i = 0; i < opt_threads; i++) {
+		workers[i].wl = wl;
+		workers[i].id = i;
+		workers[i].deadline = start + opt_duration * 1e9;
+		pthread_create(&workers[i].thread, NULL, wl->run, &workers[i]);
+	}
+	for (i = 0; i < opt_threads; i++) {
+		pthread_join(workers[i].thread, NULL);
+		error |= workers[i].error;
+		jiffies += workers[i].jiffies;
+		cpu_us += workers[i].cpu_us;
+		lines += workers[i].lines;
+	}
+
+	/* a failed run has nothing worth comparing against */
+	for (op = 0; !error && op < 2 && wl->ops[op]; op++) {
+		memset(lat, 0, sizeof(*lat));
+		bytes = 0;
+		for (i = 0; i < opt_threads; i++) {
+			hist_merge(lat, &workers[i].lat[op]);
+			bytes += workers[i].bytes[op];
+		}
+
+		extra[0] = '\0';
+		if (wl->run == run_chrdev)
+			snprintf(extra, sizeof(extra), "devices=%d",
+				 opt_devices);
+		if (lines)
+			snprintf(extra, sizeof(extra),
+				 "delay=%d jiffies_per_line=%.2f "
+				 "cpu_us_per_line=%.0f", opt_delay,
+				 (double) jiffies / lines,
+				 (double) cpu_us / lines);
+
+		r.workload	= wl->name;
+		r.op		= wl->ops[op];
+		r.threads	= opt_threads;
+		r.size		= wl->run == run_chrdev ? opt_size : 0;
+		r.seconds	= (now_ns() - start) / 1e9;
+		r.bytes		= bytes;
+		r.lat		= lat;
+		r.extra		= extra[0] ? extra : NULL;
+		result_print(stdout, opt_fmt, &r);
+	}
+
+	free(lat);
+	free(workers);
+	if (opt_load)
+		module_unload_all();
+	return error ? -1 : 0;
+}
+
+static void usage(const char *prog)
+{
+	size_t i;
+
+	fprintf(stderr,
+		"usage: %s [-l] [-m moddir] [-t threads] [-s size] "
+		"[-d seconds]\n"
+		"          [-D delay_jiffies] [-n devices] [-f csv|json] "
+		"[workload...]\n"
+		"workloads:", prog);
+	for (i = 0; i < NR_WORKLOADS; i++)
+		fprintf(stderr, " %s", workloads[i].name);
+	fprintf(stderr, "\n"
+		"not covered, read directly: cur_time_bench cur_time_skew "
+		"vram_bench\n"
+		"          jitpool jit_load jittimer jittasklet "
+		"jittasklethi\n");
+	exit(2);
+}
+
+int main(int argc, char **argv)
+{
+	size_t i;
+	int c, ret = 0, ran;
+
+	while ((c = getopt(argc, argv, "lm:t:s:d:D:n:f:h")) != -1) {
+		switch (c) {
+		case 'l':
+			opt_load = 1;
+			break;
+		case 'm':
+			opt_moddir = optarg;
+			break;
+		case 't':
+			opt_threads = atoi(optarg);
+			break;
+		case 's':
+			opt_size = strtoul(optarg, NULL, 0);
+			break;
+		case 'd':
+			opt_duration = atof(optarg);
+			break;
+		case 'D':
+			opt_delay = atoi(optarg);
+			break;
+		case 'n':
+			opt_devices = atoi(optarg);
+			break;
+		case 'f':
+			if (out_format_parse(optarg, &opt_fmt))
+				usage(argv[0]);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (opt_threads < 1 || opt_devices < 1 || !opt_size ||
+	    opt_duration <= 0)
+		usage(argv[0]);
+	for (c = optind; c < argc; c++) {
+		for (i = 0; i < NR_WORKLOADS; i++)
+			if (!strcmp(argv[c], workloads[i].name))
+				break;
+		if (i == NR_WORKLOADS)
+			usage(argv[0]);
+	}
+
+	result_begin(stdout, opt_fmt);
+	for (i = 0; i < NR_WORKLOADS; i++) {
+		if (optind < argc) {
+			for (c = optind, ran = 0; c < argc; c++)
+				ran |= !strcmp(argv[c], workloads[i].name);
+			if (!ran)
+				continue;
+		}
+		if (run_workload(&workloads[i]))
+			ret = 1;
+	}
+	result_end(stdout, opt_fmt);
+	return ret;
+}
@@ -0,0 +1,666 @@
+/*
+ * ddreplay.c -- replay a scripted load profile against the devices, the
+ * same traffic every time
+ *
+ * A profile is a text file of streams, each a group of threads issuing a
+ * mix of operations on a device at a given rate, and the modules to load
+ * for them. Every thread draws its operations, sizes and arrival times
+ * from a generator seeded from the profile's seed, the stream and the
+ * thread, so a profile replays the same sequence of operations on every
+ * run, whatever the device makes of them; how the threads interleave is
+ * up to the scheduler. The trace= digest in the results says whether two
+ * runs were given the same traffic.
+ *
+ *	# kertimer: readers arming the timer, now and then cancelling it
+ *	seed 1
+ *	load dd_core
+ *	load kertimer num_devices=2
+ *	stream timers path=/dev/kertimer%d devices=2 threads=4 ops=20000
+ *		rate=2000 burst=4 mix=arm:9,cancel:1
+ *
+ * Lines starting with white space go on from the one before; there are
+ * more examples in bench/profiles/. Stream keys:
+ *
+ *	path	    device, "%d" standing for the minor; thread i uses minor
+ *		    i % devices
+ *	devices	    minors to spread the threads over (1)
+ *	threads	    threads in the stream (1)
+ *	ops	    operations per thread (10000)
+ *	rate	    operations per second per thread; 0, as fast as they go (0)
+ *	burst	    operations arriving together; bursts come at random,
+ *		    rate / burst a second on average (1)
+ *	size	    bytes per operation, N or MIN-MAX, drawn uniformly (64)
+ *	mix	    op:weight,... of write, read, arm (a 1-byte read, which
+ *		    arms kertimer's timer), cancel (KT_IOC_CANCEL) and batch
+ *		    (OFD_IOC_READ_BATCH of size bytes) (write:1,read:1)
+ *	nonblock    open O_NONBLOCK, counting -EAGAIN rather than waiting (0)
+ *	fill	    what writes carry: random or zero bytes (random)
+ *
+ * All streams start together. Latency is from when an operation was due
+ * to when it returned, so time spent queued behind a slow one counts too.
+ * A row is printed per stream and operation, as CSV or JSON (see bench.h),
+ * with size the mean bytes per operation.
+ *
+ *	ddreplay -l -f json bench/profiles/kertimer.prof
+ *
+ * -l loads the profile's modules and unloads them after it, -s overrides
+ * its seed, and -n only prints the trace digests, without touching a
+ * device. Must run as root, but for -n.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+
+#include "bench.h"
+#include "../ofd_ioctl.h"
+#include "../kertimer_ioctl.h"
+
+/* The command line */
+static int opt_load;
+static const char *opt_moddir	= ".";
+static int opt_seed_set;
+static uint64_t opt_seed;
+static int opt_dry_run;
+static enum out_format opt_fmt	= OUT_CSV;
+
+enum op {
+	OP_WRITE,
+	OP_READ,
+	OP_ARM,
+	OP_CANCEL,
+	OP_BATCH,
+	NR_OPS
+};
+
+static const char *const op_names[NR_OPS] = {
+	"write", "read", "arm", "cancel", "batch"
+};
+
+#define MAX_STREAMS	16
+#define MAX_MODULES	8
+
+struct stream {
+	char name[32];
+	char path[64];
+	int devices, threads;
+	long ops;
+	double rate;
+	int burst;
+	size_t size_min, size_max;
+	unsigned int weight[NR_OPS], total;
+	int nonblock, zero_fill;
+};
+
+struct profile {
+	const char *file;
+	uint64_t seed;
+	char modules[MAX_MODULES][2][128];	/* name, params */
+	int nr_modules;
+	struct stream streams[MAX_STREAMS];
+	int nr_streams;
+};
+
+struct worker {
+	const struct stream *st;
+	int sidx, id;
+	pthread_t thread;
+	uint64_t rng;
+	uint64_t trace;			/* FNV-1a of what was drawn */
+	uint64_t end;
+	struct hist lat[NR_OPS];
+	uint64_t bytes[NR_OPS];
+	uint64_t eagain, errors;
+	int error;
+};
+
+static pthread_barrier_t start_barrier;
+static uint64_t start_ns;
+
+/*
+ * The traffic: splitmix64, seeded per thread, drives every choice
+ */
+static uint64_t rng_next(uint64_t *s)
+{
+	uint64_t z = (*s += 0x9e3779b97f4a7c15ULL);
+
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	return z ^ (z >> 31);
+}
+
+/* Uniform in [0, 1) */
+static double rng_unit(uint64_t *s)
+{
+	return (rng_next(s) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static void trace_add(uint64_t *h, uint64_t v)
+{
+	int i;
+
+	for (i = 0; i < 8; i++, v >>= 8)
+		*h = (*h ^ (v & 0xff)) * 0x100000001b3ULL;
+}
+
+/* One operation drawn: what, how big, and how long after the last one */
+struct draw {
+	enum op op;
+	size_t size;
+	uint64_t gap_ns;
+};
+
+static void draw_next(struct worker *w, long i, struct draw *d)
+{
+	const struct stream *st = w->st;
+	unsigned int pick;
+	int op;
+
+	/* bursts arrive as a Poisson process, their ops back to back */
+	d->gap_ns = 0;
+	if (st->rate > 0 && i % st->burst == 0)
+		d->gap_ns = -log(1 - rng_unit(&w->rng)) * 1e9 * st->burst /
+			    st->rate;
+	pick = rng_next(&w->rng) % st->total;
+	for (op = 0; pick >= st->weight[op]; op++)
+		pick -= st->weight[op];
+	d->op = op;
+	d->size = st->size_min;
+	if (st->size_max > st->size_min)
+		d->size += rng_next(&w->rng) %
+			   (st->size_max - st->size_min + 1);
+	if (d->op == OP_ARM || d->op == OP_CANCEL)
+		d->size = d->op == OP_ARM;
+
+	trace_add(&w->trace, d->op);
+	trace_add(&w->trace, d->size);
+	trace_add(&w->trace, d->gap_ns);
+}
+
+static void worker_init(struct worker *w, const struct profile *pr, int sidx,
+			int id)
+{
+	memset(w, 0, sizeof(*w));
+	w->st = &pr->streams[sidx];
+	w->sidx = sidx;
+	w->id = id;
+	w->rng = pr->seed ^ ((uint64_t) sidx << 48) ^ ((uint64_t) id << 32);
+	rng_next(&w->rng);
+	w->trace = 0xcbf29ce484222325ULL;
+}
+
+/*
+ * Replay
+ */
+
+/* Sleeps until shortly before t, then spins the rest of the way */
+static void wait_until(uint64_t t)
+{
+	struct timespec ts;
+	uint64_t now = now_ns();
+
+	if (t > now + 100000) {
+		t -= 50000;
+		ts.tv_sec = t / 1000000000ULL;
+		ts.tv_nsec = t % 1000000000ULL;
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+		t += 50000;
+	}
+	while (now_ns() < t)
+		;
+}
+
+static ssize_t do_op(int fd, const struct draw *d, char *buf)
+{
+	struct ofd_batch b;
+
+	switch (d->op) {
+	case OP_WRITE:
+		return pwrite(fd, buf, d->size, 0);
+	case OP_READ:
+	case OP_ARM:
+		return pread(fd, buf, d->size, 0);
+	case OP_CANCEL:
+		return ioctl(fd, KT_IOC_CANCEL) < 0 ? -1 : 0;
+	case OP_BATCH:
+		b.buf = (uintptr_t) buf;
+		b.len = d->size;
+		b.nr = 0;
+		return ioctl(fd, OFD_IOC_READ_BATCH, &b);
+	default:
+		errno = EINVAL;
+		return -1;
+	}
+}
+
+static void *run_worker(void *arg)
+{
+	struct worker *w = arg;
+	const struct stream *st = w->st;
+	struct draw d;
+	char path[64];
+	uint64_t due, t1, fill = w->rng ^ 0x5555555555555555ULL;
+	char *buf;
+	ssize_t n;
+	size_t i;
+	long op;
+	int fd;
+
+	snprintf(path, sizeof(path), st->path, w->id % st->devices);
+	buf = malloc(st->size_max ? st->size_max : 1);
+	fd = open(path, O_RDWR | (st->nonblock ? O_NONBLOCK : 0));
+	if (!buf || fd < 0) {
+		fprintf(stderr, "%s: %s: %s\n", st->name, path,
+			strerror(errno));
+		w->error = 1;
+	}
+	if (buf)
+		for (i = 0; i < st->size_max; i++)
+			buf[i] = st->zero_fill ? 0 : rng_next(&fill);
+
+	pthread_barrier_wait(&start_barrier);
+	due = start_ns;
+	for (op = 0; !w->error && op < st->ops; op++) {
+		draw_next(w, op, &d);
+		due += d.gap_ns;
+		if (st->rate > 0)
+			wait_until(due);
+		else
+			due = now_ns();
+
+		n = do_op(fd, &d, buf);
+		t1 = now_ns();
+		if (n < 0 && errno == EAGAIN) {
+			w->eagain++;
+			continue;
+		}
+		if (n < 0) {
+			w->errors++;
+			continue;
+		}
+		hist_add(&w->lat[d.op], t1 - due);
+		if (d.op != OP_CANCEL)
+			w->bytes[d.op] += n;
+	}
+	w->end = now_ns();
+
+	if (fd >= 0)
+		close(fd);
+	free(buf);
+	return NULL;
+}
+
+static int load_modules(const struct profile *pr)
+{
+	int i;
+
+	for (i = 0; i < pr->nr_modules; i++)
+		if (module_load(opt_moddir, pr->modules[i][0],
+				pr->modules[i][1]))
+			return -1;
+	for (i = 0; i < pr->nr_streams; i++) {
+		char path[64];
+
+		snprintf(path, sizeof(path), pr->streams[i].path,
+			 pr->streams[i].devices - 1);
+		if (wait_for_path(path, 2000))
+			return -1;
+	}
+	return 0;
+}
+
+static void report(const struct profile *pr, struct worker *workers,
+		   int nr_workers)
+{
+	const struct stream *st;
+	struct hist *lat;
+	struct result r;
+	char extra[160];
+	uint64_t bytes, trace, eagain, errors, end;
+	int s, i, op;
+
+	lat = calloc(1, sizeof(*lat));
+	if (!lat) {
+		perror("calloc");
+		exit(1);
+	}
+	for (s = 0; s < pr->nr_streams; s++) {
+		st = &pr->streams[s];
+		trace = 0xcbf29ce484222325ULL;
+		eagain = errors = end = 0;
+		for (i = 0; i < nr_workers; i++) {
+			if (workers[i].sidx != s)
+				continue;
+			trace_add(&trace, workers[i].trace);
+			eagain += workers[i].eagain;
+			errors += workers[i].errors;
+			if (workers[i].end > end)
+				end = workers[i].end;
+		}
+		if (opt_dry_run) {
+			printf("%s %s trace=%016llx\n", pr->file, st->name,
+			       (unsigned long long) trace);
+			continue;
+		}
+
+		for (op = 0; op < NR_OPS; op++) {
+			if (!st->weight[op])
+				continue;
+			memset(lat, 0, sizeof(*lat));
+			bytes = 0;
+			for (i = 0; i < nr_workers; i++) {
+				if (workers[i].sidx != s)
+					continue;
+				hist_merge(lat, &workers[i].lat[op]);
+				bytes += workers[i].bytes[op];
+			}
+			snprintf(extra, sizeof(extra), "seed=%llu "
+				 "trace=%016llx rate=%.0f burst=%d eagain=%llu "
+				 "errors=%llu", (unsigned long long) pr->seed,
+				 (unsigned long long) trace, st->rate,
+				 st->burst, (unsigned long long) eagain,
+				 (unsigned long long) errors);
+
+			r.workload	= st->name;
+			r.op		= op_names[op];
+			r.threads	= st->threads;
+			r.size		= lat->count ? bytes / lat->count : 0;
+			r.seconds	= (end - start_ns) / 1e9;
+			r.bytes		= bytes;
+			r.lat		= lat;
+			r.extra		= extra;
+			result_print(stdout, opt_fmt, &r);
+		}
+	}
+	free(lat);
+}
+
+static int replay(const struct profile *pr)
+{
+	struct worker *workers;
+	struct draw d;
+	int nr_workers = 0, s, i, error = 0;
+	long op;
+
+	for (s = 0; s < pr->nr_streams; s++)
+		nr_workers += pr->streams[s].threads;
+	workers = calloc(nr_workers, sizeof(*workers));
+	if (!workers) {
+		perror("calloc");
+		exit(1);
+	}
+	for (s = 0, i = 0; s < pr->nr_streams; s++) {
+		int id;
+
+		for (id = 0; id < pr->streams[s].threads; id++)
+			worker_init(&workers[i++], pr, s, id);
+	}
+
+	if (opt_dry_run) {
+		for (i = 0; i < nr_workers; i++) {
+			for (op = 0; op < workers[i].st->ops; op++)
+				draw_next(&workers[i], op, &d);
+		}
+		report(pr, workers, nr_workers);
+		free(workers);
+		return 0;
+	}
+
+	if (opt_load && load_modules(pr)) {
+		module_unload_all();
+		free(workers);
+		return -1;
+	}
+
+	pthread_barrier_init(&start_barrier, NULL, nr_workers + 1);
+	for (i = 0; i < nr_workers; i++)
+		pthread_create(&workers[i].thread, NULL, run_worker,
+			       &workers[i]);
+	/* everybody has its device open: go, a moment from now */
+	start_ns = now_ns() + 1000000;
+	pthread_barrier_wait(&start_barrier);
+	for (i = 0; i < nr_workers; i++) {
+		pthread_join(workers[i].thread, NULL);
+		error |= workers[i].error;
+	}
+	pthread_barrier_destroy(&start_barrier);
+
+	/* a failed run has nothing worth comparing against */
+	if (!error)
+		report(pr, workers, nr_workers);
+	free(workers);
+	if (opt_load)
+		module_unload_all();
+	return error ? -1 : 0;
+}
+
+/*
+ * Profiles
+ */
+static int parse_mix(struct stream *st, char *val)
+{
+	char *tok, *save, *w;
+	int op;
+
+	memset(st->weight, 0, sizeof(st->weight));
+	for (tok = strtok_r(val, ",", &save); tok;
+	     tok = strtok_r(NULL, ",", &save)) {
+		w = strchr(tok, ':');
+		if (w)
+			*w++ = '\0';
+		for (op = 0; op < NR_OPS; op++)
+			if (!strcmp(tok, op_names[op]))
+				break;
+		if (op == NR_OPS)
+			return -1;
+		st->weight[op] = w ? strtoul(w, NULL, 0) : 1;
+	}
+	return 0;
+}
+
+static int parse_key(struct stream *st, char *key, char *val)
+{
+	char *end;
+
+	if (!strcmp(key, "path"))
+		snprintf(st->path, sizeof(st->path), "%s", val);
+	else if (!strcmp(key, "devices"))
+		st->devices = atoi(val);
+	else if (!strcmp(key, "threads"))
+		st->threads = atoi(val);
+	else if (!strcmp(key, "ops"))
+		st->ops = atol(val);
+	else if (!strcmp(key, "rate"))
+		st->rate = atof(val);
+	else if (!strcmp(key, "burst"))
+		st->burst = atoi(val);
+	else if (!strcmp(key, "size")) {
+		st->size_min = st->size_max = strtoul(val, &end, 0);
+		if (*end == '-')
+			st->size_max = strtoul(end + 1, NULL, 0);
+	} else if (!strcmp(key, "mix"))
+		return parse_mix(st, val);
+	else if (!strcmp(key, "nonblock"))
+		st->nonblock = atoi(val);
+	else if (!strcmp(key, "fill"))
+		st->zero_fill = !strcmp(val, "zero");
+	else
+		return -1;
+	return 0;
+}
+
+static int parse_stream(struct stream *st, char *name, char *save)
+{
+	char *tok, *val;
+	int op;
+
+	memset(st, 0, sizeof(*st));
+	snprintf(st->name, sizeof(st->name), "%s", name);
+	st->devices	= 1;
+	st->threads	= 1;
+	st->ops		= 10000;
+	st->burst	= 1;
+	st->size_min	= st->size_max = 64;
+	st->weight[OP_WRITE] = st->weight[OP_READ] = 1;
+
+	while ((tok = strtok_r(NULL, " \t\n", &save))) {
+		val = strchr(tok, '=');
+		if (!val)
+			return -1;
+		*val++ = '\0';
+		if (parse_key(st, tok, val)) {
+			fprintf(stderr, "%s: bad %s\n", st->name, tok);
+			return -1;
+		}
+	}
+	for (op = 0; op < NR_OPS; op++)
+		st->total += st->weight[op];
+	if (!st->path[0] || st->devices < 1 || st->threads < 1 ||
+	    st->ops < 1 || st->rate < 0 || st->burst < 1 || !st->total ||
+	    st->size_max < st->size_min)
+		return -1;
+	return 0;
+}
+
+/* A line and the ones that go on from it, comments cut; 0 at the end */
+static int read_line(FILE *f, char *line, int size, int *lineno)
+{
+	size_t n = 0;
+	int c;
+
+	line[0] = '\0';
+	do {
+		if (!fgets(line + n, size - n, f))
+			return n > 0;
+		(*lineno)++;
+		line[n + strcspn(line + n, "#\n")] = '\0';
+		n = strlen(line);
+		if (n + 1 < (size_t) size)
+			line[n++] = ' ';
+		line[n] = '\0';
+		c = fgetc(f);
+		if (c != EOF)
+			ungetc(c, f);
+	} while (c == ' ' || c == '\t');
+	return 1;
+}
+
+static int parse_profile(const char *file, struct profile *pr)
+{
+	char line[1024], *tok, *save, *rest;
+	int lineno = 0, c;
+	FILE *f;
+
+	memset(pr, 0, sizeof(*pr));
+	pr->file = file;
+	f = fopen(file, "r");
+	if (!f) {
+		fprintf(stderr, "%s: %s\n", file, strerror(errno));
+		return -1;
+	}
+	while (read_line(f, line, sizeof(line), &lineno)) {
+		tok = strtok_r(line, " \t\n", &save);
+		if (!tok)
+			continue;
+		if (!strcmp(tok, "seed") && (tok = strtok_r(NULL, " \t\n",
+							    &save))) {
+			pr->seed = strtoull(tok, NULL, 0);
+		} else if (!strcmp(tok, "load") &&
+			   pr->nr_modules < MAX_MODULES &&
+			   (tok = strtok_r(NULL, " \t\n", &save))) {
+			snprintf(pr->modules[pr->nr_modules][0],
+				 sizeof(pr->modules[0][0]), "%s", tok);
+			/* the rest of the line are its parameters */
+			rest = save + strspn(save, " \t");
+			rest[strcspn(rest, "\n")] = '\0';
+			for (c = strlen(rest); c > 0 && rest[c - 1] == ' '; c--)
+				rest[c - 1] = '\0';
+			snprintf(pr->modules[pr->nr_modules][1],
+				 sizeof(pr->modules[0][1]), "%s", rest);
+			pr->nr_modules++;
+		} else if (!strcmp(tok, "stream") &&
+			   pr->nr_streams < MAX_STREAMS &&
+			   (tok = strtok_r(NULL, " \t\n", &save)) &&
+			   !parse_stream(&pr->streams[pr->nr_streams], tok,
+					 save)) {
+			pr->nr_streams++;
+		} else {
+			fprintf(stderr, "%s:%d: can't make sense of this\n",
+				file, lineno);
+			fclose(f);
+			return -1;
+		}
+	}
+	fclose(f);
+	if (!pr->nr_streams) {
+		fprintf(stderr, "%s: no streams\n", file);
+		return -1;
+	}
+	if (opt_seed_set)
+		pr->seed = opt_seed;
+	return 0;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [-l] [-m moddir] [-s seed] [-n] [-f csv|json] "
+		"profile...\n", prog);
+	exit(2);
+}
+
+int main(int argc, char **argv)
+{
+	struct profile *pr;
+	int c, ret = 0;
+
+	while ((c = getopt(argc, argv, "lm:s:nf:h")) != -1) {
+		switch (c) {
+		case 'l':
+			opt_load = 1;
+			break;
+		case 'm':
+			opt_moddir = optarg;
+			break;
+		case 's':
+			opt_seed = strtoull(optarg, NULL, 0);
+			opt_seed_set = 1;
+			break;
+		case 'n':
+			opt_dry_run = 1;
+			break;
+		case 'f':
+			if (out_format_parse(optarg, &opt_fmt))
+				usage(argv[0]);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (optind == argc)
+		usage(argv[0]);
+
+	pr = malloc(sizeof(*pr));
+	if (!pr) {
+		perror("malloc");
+		exit(1);
+	}
+	if (!opt_dry_run)
+		result_begin(stdout, opt_fmt);
+	for (c = optind; c < argc; c++) {
+		if (parse_profile(argv[c], pr) || replay(pr))
+			ret = 1;
+	}
+	if (!opt_dry_run)
+		result_end(stdout, opt_fmt);
+	free(pr);
+	return ret;
+}
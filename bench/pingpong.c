@@ -0,0 +1,491 @@
+/*
+ * pingpong.c -- bounce a token between two pinned processes and time the
+ * round trips
+ *
+ * The parent hands the token to a forked child, which hands it straight
+ * back, rounds times over. Through sleepy the token is a write() to the
+ * other side's minor, which wakes the read() waiting there: /dev/sleepy0
+ * towards the child, /dev/sleepy1 back. futex and eventfd do the same with
+ * a futex word or an eventfd each way, as the baselines to hold sleepy's
+ * wait queues up against. The parent times every round trip and prints a
+ * row per transport and placement, as CSV or JSON (see bench.h); ops_per_s
+ * is round trips per second.
+ *
+ *	pingpong -l -r 1000000 -f json sleepy futex eventfd
+ *
+ * The placements are same-core, both processes on one CPU, same-socket, on
+ * two cores of one package (SMT siblings only if there are no others), and
+ * cross-socket, on two packages; -p picks some. Those the machine can't do
+ * are skipped.
+ *
+ * -l loads dd_core and sleepy, with two minors and -S as its spin_ns, and
+ * unloads them at the end. sleepy needs root, for that and for the device
+ * nodes; the baselines don't.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+
+#include "bench.h"
+
+/* The command line */
+static long opt_rounds		= 1000000;
+static int opt_load;
+static const char *opt_moddir	= ".";
+static unsigned int opt_spin_ns;
+static const char *opt_placements = "same-core,same-socket,cross-socket";
+static enum out_format opt_fmt	= OUT_CSV;
+
+/* Not timed, to get the caches and the CPUs' clocks going */
+#define WARMUP		1000
+
+/*
+ * Transports: a way for either side to hand the token over, towards the
+ * child (dir 0) or back to the parent (dir 1), and to wait for it
+ */
+struct transport {
+	const char *name;
+	int (*setup)(void);
+	int (*post)(int dir);
+	int (*wait)(int dir);
+	void (*teardown)(void);
+};
+
+/* sleepy: a write to a minor wakes the read waiting on it */
+static int sleepy_fd[2] = { -1, -1 };
+
+static int sleepy_setup(void)
+{
+	char path[32];
+	int dir;
+
+	if (opt_load) {
+		char params[64];
+
+		snprintf(params, sizeof(params), "num_devices=2 spin_ns=%u",
+			 opt_spin_ns);
+		if (module_load(opt_moddir, "dd_core", "") ||
+		    module_load(opt_moddir, "sleepy", params) ||
+		    wait_for_path("/dev/sleepy1", 2000))
+			return -1;
+	}
+	for (dir = 0; dir < 2; dir++) {
+		snprintf(path, sizeof(path), "/dev/sleepy%d", dir);
+		sleepy_fd[dir] = open(path, O_RDWR);
+		if (sleepy_fd[dir] < 0) {
+			fprintf(stderr, "%s: %s\n", path, strerror(errno));
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static int sleepy_post(int dir)
+{
+	return write(sleepy_fd[dir], "x", 1) == 1 ? 0 : -1;
+}
+
+static int sleepy_wait(int dir)
+{
+	char c;
+
+	return read(sleepy_fd[dir], &c, 1) < 0 ? -1 : 0;
+}
+
+static void sleepy_teardown(void)
+{
+	int dir;
+
+	for (dir = 0; dir < 2; dir++) {
+		if (sleepy_fd[dir] >= 0)
+			close(sleepy_fd[dir]);
+		sleepy_fd[dir] = -1;
+	}
+	if (opt_load)
+		module_unload_all();
+}
+
+/* futex: a word each way in shared memory, 1 while the token is there */
+static int *futex_word;
+
+static int futex_setup(void)
+{
+	futex_word = mmap(NULL, 2 * sizeof(int), PROT_READ | PROT_WRITE,
+			  MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (futex_word == MAP_FAILED) {
+		perror("mmap");
+		return -1;
+	}
+	futex_word[0] = futex_word[1] = 0;
+	return 0;
+}
+
+static int futex_post(int dir)
+{
+	__atomic_store_n(&futex_word[dir], 1, __ATOMIC_RELEASE);
+	return syscall(SYS_futex, &futex_word[dir], FUTEX_WAKE, 1, NULL,
+		       NULL, 0) < 0 ? -1 : 0;
+}
+
+static int futex_wait(int dir)
+{
+	while (!__atomic_exchange_n(&futex_word[dir], 0, __ATOMIC_ACQUIRE))
+		if (syscall(SYS_futex, &futex_word[dir], FUTEX_WAIT, 0, NULL,
+			    NULL, 0) < 0 && errno != EAGAIN && errno != EINTR)
+			return -1;
+	return 0;
+}
+
+static void futex_teardown(void)
+{
+	munmap(futex_word, 2 * sizeof(int));
+}
+
+/* eventfd: one each way, written to post and read to wait */
+static int event_fd[2] = { -1, -1 };
+
+static int eventfd_setup(void)
+{
+	int dir;
+
+	for (dir = 0; dir < 2; dir++) {
+		event_fd[dir] = eventfd(0, 0);
+		if (event_fd[dir] < 0) {
+			perror("eventfd");
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static int eventfd_post(int dir)
+{
+	uint64_t one = 1;
+
+	return write(event_fd[dir], &one, sizeof(one)) == sizeof(one) ?
+		0 : -1;
+}
+
+static int eventfd_wait(int dir)
+{
+	uint64_t n;
+
+	return read(event_fd[dir], &n, sizeof(n)) == sizeof(n) ? 0 : -1;
+}
+
+static void eventfd_teardown(void)
+{
+	int dir;
+
+	for (dir = 0; dir < 2; dir++) {
+		if (event_fd[dir] >= 0)
+			close(event_fd[dir]);
+		event_fd[dir] = -1;
+	}
+}
+
+static const struct transport transports[] = {
+	{ "sleepy", sleepy_setup, sleepy_post, sleepy_wait, sleepy_teardown },
+	{ "futex", futex_setup, futex_post, futex_wait, futex_teardown },
+	{ "eventfd", eventfd_setup, eventfd_post, eventfd_wait,
+	  eventfd_teardown },
+};
+
+#define NR_TRANSPORTS	(sizeof(transports) / sizeof(transports[0]))
+
+/*
+ * A child that fails sends the parent SIGTERM. The handler hands the
+ * parent the token itself, which ends its wait whether or not it has
+ * started yet, and the run fails with everything torn down as usual.
+ */
+static const struct transport *running;
+static volatile sig_atomic_t peer_failed;
+
+static void peer_failed_handler(int sig)
+{
+	int saved = errno;
+
+	peer_failed = 1;
+	running->post(1);
+	errno = saved;
+}
+
+/*
+ * Placements, from the CPUs we may run on and what sysfs says about them.
+ * Those are the ones we were started with: each run pins the parent.
+ */
+static cpu_set_t allowed_cpus;
+
+static int cpu_topology(int cpu, const char *what)
+{
+	char path[96];
+	FILE *f;
+	int v = -1;
+
+	snprintf(path, sizeof(path),
+		 "/sys/devices/system/cpu/cpu%d/topology/%s", cpu, what);
+	f = fopen(path, "r");
+	if (!f)
+		return -1;
+	if (fscanf(f, "%d", &v) != 1)
+		v = -1;
+	fclose(f);
+	return v;
+}
+
+/*
+ * The two CPUs of a placement, or -1 if this machine doesn't have them:
+ * the first CPU we may use, and a partner for it
+ */
+static int placement_cpus(const char *name, int cpus[2])
+{
+	const cpu_set_t *set = &allowed_cpus;
+	int cpu, pkg, core, sibling = -1;
+
+	for (cpus[0] = 0; cpus[0] < CPU_SETSIZE; cpus[0]++)
+		if (CPU_ISSET(cpus[0], set))
+			break;
+	if (cpus[0] == CPU_SETSIZE)
+		return -1;
+	if (!strcmp(name, "same-core")) {
+		cpus[1] = cpus[0];
+		return 0;
+	}
+
+	pkg = cpu_topology(cpus[0], "physical_package_id");
+	core = cpu_topology(cpus[0], "core_id");
+	for (cpu = cpus[0] + 1; cpu < CPU_SETSIZE; cpu++) {
+		if (!CPU_ISSET(cpu, set))
+			continue;
+		if (!strcmp(name, "cross-socket")) {
+			if (cpu_topology(cpu, "physical_package_id") != pkg)
+				break;
+		} else if (cpu_topology(cpu, "physical_package_id") == pkg) {
+			if (cpu_topology(cpu, "core_id") != core)
+				break;
+			if (sibling < 0)
+				sibling = cpu;
+		}
+	}
+	if (cpu < CPU_SETSIZE)
+		cpus[1] = cpu;
+	else if (sibling >= 0)
+		cpus[1] = sibling;
+	else
+		return -1;
+	return 0;
+}
+
+/*
+ * One run: the child answers every post towards it, the parent posts and
+ * times each round trip
+ */
+static void child(const struct transport *t, int cpu, long rounds)
+{
+	long i;
+
+	signal(SIGTERM, SIG_DFL);
+	if (pin_to_cpu(cpu))
+		perror("sched_setaffinity");
+	for (i = 0; i < rounds; i++) {
+		if (t->wait(0) || t->post(1)) {
+			perror(t->name);
+			/* don't leave the parent waiting for us */
+			kill(getppid(), SIGTERM);
+			_exit(1);
+		}
+	}
+	_exit(0);
+}
+
+static int run(const struct transport *t, const char *placement)
+{
+	struct sigaction sa = { .sa_handler = peer_failed_handler };
+	struct hist *lat;
+	struct result r;
+	char extra[64];
+	uint64_t start, t0;
+	int cpus[2], status, error = 0;
+	long i;
+	pid_t pid;
+
+	if (placement_cpus(placement, cpus)) {
+		fprintf(stderr, "%s: no %s placement here, skipped\n",
+			t->name, placement);
+		return 0;
+	}
+	lat = calloc(1, sizeof(*lat));
+	if (!lat) {
+		perror("calloc");
+		exit(1);
+	}
+	if (t->setup()) {
+		t->teardown();
+		free(lat);
+		return -1;
+	}
+
+	/* no SA_RESTART: a wait the signal interrupts fails straight away */
+	running = t;
+	peer_failed = 0;
+	sigaction(SIGTERM, &sa, NULL);
+	pid = fork();
+	if (pid < 0) {
+		perror("fork");
+		exit(1);
+	}
+	if (pid == 0)
+		child(t, cpus[1], WARMUP + opt_rounds);
+	if (pin_to_cpu(cpus[0]))
+		perror("sched_setaffinity");
+
+	start = now_ns();
+	for (i = 0; i < WARMUP + opt_rounds; i++) {
+		if (i == WARMUP)
+			start = now_ns();
+		t0 = now_ns();
+		if (t->post(0) || t->wait(1) || peer_failed) {
+			if (!peer_failed)
+				perror(t->name);
+			kill(pid, SIGKILL);
+			error = 1;
+			break;
+		}
+		if (i >= WARMUP)
+			hist_add(lat, now_ns() - t0);
+	}
+	if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) ||
+	    WEXITSTATUS(status))
+		error = 1;
+	signal(SIGTERM, SIG_DFL);
+	if (sched_setaffinity(0, sizeof(allowed_cpus), &allowed_cpus))
+		perror("sched_setaffinity");
+
+	if (!error) {
+		snprintf(extra, sizeof(extra), "parent_cpu=%d child_cpu=%d",
+			 cpus[0], cpus[1]);
+		r.workload	= t->name;
+		r.op		= placement;
+		r.threads	= 2;
+		r.size		= 0;
+		r.seconds	= (now_ns() - start) / 1e9;
+		r.bytes		= 0;
+		r.lat		= lat;
+		r.extra		= extra;
+		result_print(stdout, opt_fmt, &r);
+	}
+	t->teardown();
+	free(lat);
+	return error ? -1 : 0;
+}
+
+static void usage(const char *prog)
+{
+	size_t i;
+
+	fprintf(stderr,
+		"usage: %s [-l] [-m moddir] [-S spin_ns] [-r rounds]\n"
+		"          [-p placement,...] [-f csv|json] [transport...]\n"
+		"placements: same-core same-socket cross-socket\n"
+		"transports:", prog);
+	for (i = 0; i < NR_TRANSPORTS; i++)
+		fprintf(stderr, " %s", transports[i].name);
+	fprintf(stderr, "\n");
+	exit(2);
+}
+
+static int placement_valid(const char *name)
+{
+	return !strcmp(name, "same-core") || !strcmp(name, "same-socket") ||
+		!strcmp(name, "cross-socket");
+}
+
+static int asked_for(int argc, char **argv, const char *name)
+{
+	int c;
+
+	if (optind == argc)
+		return 1;
+	for (c = optind; c < argc; c++)
+		if (!strcmp(argv[c], name))
+			return 1;
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	char *placements, *p, *save;
+	size_t i;
+	int c, ret = 0;
+
+	while ((c = getopt(argc, argv, "lm:S:r:p:f:h")) != -1) {
+		switch (c) {
+		case 'l':
+			opt_load = 1;
+			break;
+		case 'm':
+			opt_moddir = optarg;
+			break;
+		case 'S':
+			opt_spin_ns = strtoul(optarg, NULL, 0);
+			break;
+		case 'r':
+			opt_rounds = atol(optarg);
+			break;
+		case 'p':
+			opt_placements = optarg;
+			break;
+		case 'f':
+			if (out_format_parse(optarg, &opt_fmt))
+				usage(argv[0]);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (opt_rounds < 1)
+		usage(argv[0]);
+	placements = strdup(opt_placements);
+	for (p = strtok_r(placements, ",", &save); p;
+	     p = strtok_r(NULL, ",", &save))
+		if (!placement_valid(p))
+			usage(argv[0]);
+	free(placements);
+	for (c = optind; c < argc; c++) {
+		for (i = 0; i < NR_TRANSPORTS; i++)
+			if (!strcmp(argv[c], transports[i].name))
+				break;
+		if (i == NR_TRANSPORTS)
+			usage(argv[0]);
+	}
+
+	if (sched_getaffinity(0, sizeof(allowed_cpus), &allowed_cpus)) {
+		perror("sched_getaffinity");
+		return 1;
+	}
+	result_begin(stdout, opt_fmt);
+	for (i = 0; i < NR_TRANSPORTS; i++) {
+		if (!asked_for(argc, argv, transports[i].name))
+			continue;
+		placements = strdup(opt_placements);
+		for (p = strtok_r(placements, ",", &save); p;
+		     p = strtok_r(NULL, ",", &save))
+			if (run(&transports[i], p))
+				ret = 1;
+		free(placements);
+	}
+	result_end(stdout, opt_fmt);
+	return ret;
+}
@@ -0,0 +1,270 @@
+/*
+ * dd_compat.h -- paper over kernel API changes, from 4.4 on
+ *
+ * The modules are written against the current API; this header fills it
+ * in on kernels that predate it. Where a change can't be detected from the
+ * headers themselves, the Makefile greps the kernel's headers and passes
+ * HAVE_* flags (see the `probe` lines there).
+ */
+
+#ifndef _DD_COMPAT_H
+#define _DD_COMPAT_H
+
+#include <linux/version.h>
+#include <linux/kernel.h>
+#include <linux/fs.h>
+#include <linux/device.h>
+#include <linux/timer.h>
+#include <linux/hrtimer.h>
+#include <linux/interrupt.h>	/* tasklets */
+#include <linux/ktime.h>
+#include <linux/timekeeping.h>
+#include <linux/proc_fs.h>
+#include <linux/poll.h>
+#include <linux/mm.h>
+#include <linux/vmalloc.h>
+#include <linux/huge_mm.h>
+#include <linux/uaccess.h>	/* access_ok */
+#ifdef HAVE_INSERT_PFN_PMD_PFN_T
+#include <linux/pfn_t.h>
+#endif
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 11, 0)
+#include <linux/sched/clock.h>	/* local_clock(), sched_clock() */
+#else
+#include <linux/sched.h>
+#endif
+
+/*
+ * /proc files: struct proc_ops replaced file_operations in 5.6
+ *
+ *	static const struct dd_proc_ops foo_proc_ops = {
+ *		DD_PROC_OPS(foo_open, seq_read, NULL, seq_lseek, seq_release)
+ *	};
+ */
+#ifdef HAVE_PROC_OPS
+#define dd_proc_ops	proc_ops
+#define DD_PROC_OPS(_open, _read, _write, _lseek, _release)		\
+	.proc_open	= _open,					\
+	.proc_read	= _read,					\
+	.proc_write	= _write,					\
+	.proc_lseek	= _lseek,					\
+	.proc_release	= _release
+#else
+#define dd_proc_ops	file_operations
+#define DD_PROC_OPS(_open, _read, _write, _lseek, _release)		\
+	.owner		= THIS_MODULE,					\
+	.open		= _open,					\
+	.read		= _read,					\
+	.write		= _write,					\
+	.llseek		= _lseek,					\
+	.release	= _release
+#endif
+
+/* pde_data() was PDE_DATA() until 5.17 */
+#if LINUX_VERSION_CODE < KERNEL_VERSION(5, 17, 0)
+#define pde_data(_inode)		PDE_DATA(_inode)
+#endif
+
+/*
+ * Timers: timer_setup() in 4.15, timer_delete_sync() in 6.2 and
+ * timer_container_of() in 6.16
+ */
+#ifndef HAVE_TIMER_SETUP
+#define timer_setup(_timer, _fn, _flags)				\
+	setup_timer(_timer, (void (*)(unsigned long)) (_fn),		\
+		    (unsigned long) (_timer))
+#endif
+
+#ifndef HAVE_TIMER_DELETE_SYNC
+#define timer_delete_sync(_timer)	del_timer_sync(_timer)
+#define timer_delete(_timer)		del_timer(_timer)
+#endif
+
+#ifndef timer_container_of
+#define timer_container_of(_var, _timer, _field)			\
+	container_of(_timer, typeof(*(_var)), _field)
+#endif
+
+/* hrtimer_setup() in 6.13 */
+#ifndef HAVE_HRTIMER_SETUP
+static inline void hrtimer_setup(struct hrtimer *timer,
+				 enum hrtimer_restart (*fn)(struct hrtimer *),
+				 clockid_t clock_id, enum hrtimer_mode mode)
+{
+	hrtimer_init(timer, clock_id, mode);
+	timer->function = fn;
+}
+#endif
+
+/* tasklet_setup() and from_tasklet() in 5.9 */
+#ifndef from_tasklet
+#define tasklet_setup(_t, _fn)						\
+	tasklet_init(_t, (void (*)(unsigned long)) (_fn),		\
+		     (unsigned long) (_t))
+#define from_tasklet(_var, _t, _field)					\
+	container_of(_t, typeof(*(_var)), _field)
+#endif
+
+/*
+ * Time: the coarse ktime accessors filled out in 4.18 and 5.3
+ */
+#if LINUX_VERSION_CODE < KERNEL_VERSION(4, 18, 0)
+#define ktime_get_coarse_real_ts64(_ts)	(*(_ts) = current_kernel_time64())
+#define ktime_get_coarse_ts64(_ts)	(*(_ts) = get_monotonic_coarse64())
+#endif
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(5, 3, 0)
+static inline u64 ktime_get_coarse_ns(void)
+{
+	struct timespec64 ts;
+
+	ktime_get_coarse_ts64(&ts);
+	return timespec64_to_ns(&ts);
+}
+#endif
+
+/*
+ * Scheduler statistics moved from task->se.statistics to task->stats
+ */
+#ifdef HAVE_TASK_STATS
+#define dd_task_schedstats(_t)		(&(_t)->stats)
+#else
+#define dd_task_schedstats(_t)		(&(_t)->se.statistics)
+#endif
+
+/*
+ * Devices: class_create() lost its owner argument in 6.4
+ */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 4, 0)
+#define dd_class_create(_name)		class_create(_name)
+#else
+#define dd_class_create(_name)		class_create(THIS_MODULE, _name)
+#endif
+
+/*
+ * Nonblocking I/O: IOCB_NOWAIT in 4.13, __poll_t and the EPOLL* masks for
+ * ->poll() in 4.16
+ */
+#ifndef IOCB_NOWAIT
+#define IOCB_NOWAIT			0
+#endif
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(4, 16, 0)
+typedef unsigned int __poll_t;
+#endif
+#ifndef EPOLLIN
+#define EPOLLIN				POLLIN
+#define EPOLLRDNORM			POLLRDNORM
+#define EPOLLOUT			POLLOUT
+#define EPOLLWRNORM			POLLWRNORM
+#endif
+
+/*
+ * ioctl: u64_to_user_ptr() in 4.6, access_ok() lost its type argument in
+ * 5.0; compat_ptr_ioctl(), for commands whose argument is laid out the same
+ * for 32-bit callers, is from 5.5
+ */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 0, 0)
+#define dd_access_ok(_p, _n)		access_ok(_p, _n)
+#else
+#define dd_access_ok(_p, _n)		access_ok(VERIFY_WRITE, _p, _n)
+#endif
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(5, 5, 0)
+#define compat_ptr_ioctl		NULL
+#endif
+
+#ifndef u64_to_user_ptr
+#define u64_to_user_ptr(_x)		((void __user *) (uintptr_t) (_x))
+#endif
+
+/*
+ * User buffers: fault_in_iov_iter_readable(), returning what could not be
+ * faulted in, was iov_iter_fault_in_readable() until 5.16
+ */
+#if LINUX_VERSION_CODE < KERNEL_VERSION(5, 16, 0)
+#include <linux/uio.h>
+static inline size_t fault_in_iov_iter_readable(const struct iov_iter *i,
+						size_t bytes)
+{
+	return iov_iter_fault_in_readable((struct iov_iter *) i, bytes) ?
+		bytes : 0;
+}
+#endif
+
+/*
+ * LZ4: the library's current API is from 4.11, and it is only there if
+ * something in the kernel's config selected it
+ */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 11, 0) &&			\
+	IS_ENABLED(CONFIG_LZ4_COMPRESS) && IS_ENABLED(CONFIG_LZ4_DECOMPRESS)
+#define DD_HAVE_LZ4
+#include <linux/lz4.h>
+#endif
+
+/*
+ * CPU hotplug: cpus_read_lock() was get_online_cpus() until 4.13
+ */
+#if LINUX_VERSION_CODE < KERNEL_VERSION(4, 13, 0)
+#include <linux/cpu.h>
+#define cpus_read_lock()		get_online_cpus()
+#define cpus_read_unlock()		put_online_cpus()
+#endif
+
+/*
+ * Memory: vmalloc_huge() in 5.18 maps with huge pages where it can
+ */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 18, 0)
+#define dd_vzalloc_huge(_size)		vmalloc_huge(_size, GFP_KERNEL | __GFP_ZERO)
+#else
+#define dd_vzalloc_huge(_size)		vzalloc(_size)
+#endif
+
+/*
+ * mmap: fault handlers returning vm_fault_t, with vmf_insert_pfn(), from
+ * 4.17; vm_flags_set() and vm_flags_clear() in 6.3
+ */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 17, 0)
+#define DD_HAVE_MMAP
+#endif
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 3, 0)
+static inline void vm_flags_set(struct vm_area_struct *vma, vm_flags_t flags)
+{
+	vma->vm_flags |= flags;
+}
+
+static inline void vm_flags_clear(struct vm_area_struct *vma,
+				  vm_flags_t flags)
+{
+	vma->vm_flags &= ~flags;
+}
+#endif
+
+/*
+ * PMD mappings from a ->huge_fault() handler, which is passed a page table
+ * level until 6.6 and an order since. vmf_insert_pfn_pmd() took a pfn_t
+ * until that went away in 6.16.
+ */
+#if defined(DD_HAVE_MMAP) && defined(CONFIG_TRANSPARENT_HUGEPAGE) &&	\
+	(defined(HAVE_INSERT_PFN_PMD_PFN_T) || defined(HAVE_INSERT_PFN_PMD_PFN))
+#define DD_HAVE_HUGE_MMAP
+
+#ifdef HAVE_HUGE_FAULT_ORDER
+typedef unsigned int dd_fault_size;
+#define DD_FAULT_PMD			(PMD_SHIFT - PAGE_SHIFT)
+#else
+typedef enum page_entry_size dd_fault_size;
+#define DD_FAULT_PMD			PE_SIZE_PMD
+#endif
+
+#ifdef HAVE_INSERT_PFN_PMD_PFN
+#define dd_vmf_insert_pfn_pmd(_vmf, _pfn, _write)			\
+	vmf_insert_pfn_pmd(_vmf, _pfn, _write)
+#else
+#define dd_vmf_insert_pfn_pmd(_vmf, _pfn, _write)			\
+	vmf_insert_pfn_pmd(_vmf, pfn_to_pfn_t(_pfn), _write)
+#endif
+#endif /* DD_HAVE_HUGE_MMAP */
+
+#endif /* _DD_COMPAT_H */
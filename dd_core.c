@@ -0,0 +1,282 @@
+/*
+ * dd_core.c -- device and /proc registration shared by the dd_primer
+ * modules, see dd_core.h
+ *
+ * Owns the "dd" class every device lives in, so a module only has to say
+ * what it wants created and can be loaded alongside all the others.
+ */
+
+#include <linux/module.h>
+#include <linux/init.h>
+
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/fs.h>
+#include <linux/cdev.h>
+#include <linux/device.h>
+#include <linux/proc_fs.h>
+#include <linux/percpu.h>
+#include <linux/seq_file.h>
+#include <linux/debugfs.h>
+#include <linux/nodemask.h>
+#include <linux/topology.h>
+
+#include "dd_compat.h"
+#include "dd_core.h"
+
+MODULE_AUTHOR("Salym Senyonga");
+MODULE_LICENSE("GPL");
+
+static struct class *dd_class;
+static struct dentry *dd_debugfs;	/* /sys/kernel/debug/dd */
+
+/*
+ * Counters, summed over the CPUs when read
+ */
+
+static const char * const dd_counter_names[DD_NR_COUNTERS] = {
+	[DD_OPENS]		= "opens",
+	[DD_READS]		= "reads",
+	[DD_WRITES]		= "writes",
+	[DD_BYTES_READ]		= "bytes_read",
+	[DD_BYTES_WRITTEN]	= "bytes_written",
+	[DD_WAITS]		= "waits",
+	[DD_SPINS]		= "spins",
+	[DD_WAKEUPS]		= "wakeups",
+	[DD_EAGAIN]		= "eagain",
+	[DD_FAULTS]		= "faults",
+	[DD_REMOTE]		= "remote",
+};
+
+/* Over the CPUs of node nid, or all of them for NUMA_NO_NODE */
+static void dd_stats_sum(struct dd_stats __percpu *st, int nid,
+			 struct dd_stats *sum)
+{
+	const struct dd_stats *c;
+	int cpu, i, j;
+
+	memset(sum, 0, sizeof(*sum));
+	for_each_possible_cpu(cpu) {
+		if (nid != NUMA_NO_NODE && cpu_to_node(cpu) != nid)
+			continue;
+		c = per_cpu_ptr(st, cpu);
+		for (i = 0; i < DD_NR_COUNTERS; i++)
+			sum->cnt[i] += c->cnt[i];
+		for (i = 0; i < 2; i++)
+			for (j = 0; j < DD_HIST_BUCKETS; j++) {
+				sum->size[i][j] += c->size[i][j];
+				sum->lat[i][j] += c->lat[i][j];
+			}
+	}
+}
+
+/* "  <from> <count>" for every bucket that has any */
+static void dd_hist_show(struct seq_file *m, const char *title,
+			 const u64 *hist)
+{
+	int i;
+
+	seq_printf(m, "%s\n", title);
+	for (i = 0; i < DD_HIST_BUCKETS; i++)
+		if (hist[i])
+			seq_printf(m, "  %20llu %llu\n",
+				   i ? 1ULL << (i - 1) : 0, hist[i]);
+}
+
+static int dd_stats_show(struct seq_file *m, void *v)
+{
+	struct dd_minor *dm = m->private;
+	struct dd_stats *sum;
+	int i, nid;
+
+	/* too big for the stack */
+	sum = kmalloc(sizeof(*sum), GFP_KERNEL);
+	if (!sum)
+		return -ENOMEM;
+	dd_stats_sum(dm->stats, NUMA_NO_NODE, sum);
+
+	for (i = 0; i < DD_NR_COUNTERS; i++)
+		seq_printf(m, "%s %llu\n", dd_counter_names[i], sum->cnt[i]);
+	dd_hist_show(m, "read_bytes", sum->size[0]);
+	dd_hist_show(m, "write_bytes", sum->size[1]);
+	dd_hist_show(m, "read_ns", sum->lat[0]);
+	dd_hist_show(m, "write_ns", sum->lat[1]);
+
+	/* the counters again, by the node of the CPU that did the work */
+	if (num_online_nodes() > 1) {
+		for_each_online_node(nid) {
+			dd_stats_sum(dm->stats, nid, sum);
+			seq_printf(m, "node%d", nid);
+			for (i = 0; i < DD_NR_COUNTERS; i++)
+				seq_printf(m, " %s %llu", dd_counter_names[i],
+					   sum->cnt[i]);
+			seq_putc(m, '\n');
+		}
+	}
+
+	kfree(sum);
+	return 0;
+}
+
+static int dd_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, dd_stats_show, inode->i_private);
+}
+
+static const struct file_operations dd_stats_fops = {
+	.owner		= THIS_MODULE,
+	.open		= dd_stats_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release
+};
+
+/*
+ * Character devices
+ */
+
+/* Undo the first nr minors of cd, newest first */
+static void dd_chrdev_destroy(struct dd_chrdev *cd, int nr)
+{
+	struct dd_minor *m;
+
+	while (nr--) {
+		m = &cd->minors[nr];
+		debugfs_remove(m->debugfs);
+		device_destroy(dd_class, cd->first + nr);
+		cdev_del(&m->cdev);
+		if (cd->teardown)
+			cd->teardown(m->priv, nr);
+		free_percpu(m->stats);
+	}
+	unregister_chrdev_region(cd->first, cd->count);
+	kfree(cd->privs);
+	kfree(cd->minors);
+	cd->privs	= NULL;
+	cd->minors	= NULL;
+}
+
+int dd_chrdev_register(struct dd_chrdev *cd)
+{
+	int nid = cd->numa_node ? *cd->numa_node : NUMA_NO_NODE;
+	struct dd_minor *m;
+	int i, ret;
+
+	if (cd->count < 1)
+		return -EINVAL;
+	if (nid != NUMA_NO_NODE &&
+	    (nid < 0 || nid >= nr_node_ids || !node_online(nid)))
+		return -EINVAL;
+
+	cd->minors = kcalloc(cd->count, sizeof(*cd->minors), GFP_KERNEL);
+	if (!cd->minors)
+		return -ENOMEM;
+	if (cd->priv_size) {
+		cd->privs = kzalloc_node(cd->count * cd->priv_size, GFP_KERNEL,
+					 nid);
+		if (!cd->privs) {
+			kfree(cd->minors);
+			return -ENOMEM;
+		}
+	}
+
+	ret = alloc_chrdev_region(&cd->first, 0, cd->count, cd->name);
+	if (ret < 0) {
+		kfree(cd->privs);
+		kfree(cd->minors);
+		return ret;
+	}
+
+	for (i = 0; i < cd->count; i++) {
+		m = &cd->minors[i];
+		if (cd->privs)
+			m->priv = cd->privs + i * cd->priv_size;
+
+		m->stats = alloc_percpu(struct dd_stats);
+		if (!m->stats) {
+			ret = -ENOMEM;
+			goto fail;
+		}
+		if (cd->setup && (ret = cd->setup(m->priv, i)) < 0)
+			goto fail_stats;
+
+		/* live first, then visible: udev may open it right away */
+		cdev_init(&m->cdev, cd->fops);
+		m->cdev.owner = cd->fops->owner;
+		if ((ret = cdev_add(&m->cdev, cd->first + i, 1)) < 0)
+			goto fail_cdev;
+
+		m->dev = device_create_with_groups(dd_class, NULL,
+						   cd->first + i, m->priv,
+						   cd->groups, cd->node, i);
+		if (IS_ERR(m->dev)) {
+			ret = PTR_ERR(m->dev);
+			cdev_del(&m->cdev);
+			goto fail_cdev;
+		}
+
+		/* nice to have: a kernel without debugfs just goes without */
+		m->debugfs = debugfs_create_file(dev_name(m->dev), 0444,
+						 dd_debugfs, m, &dd_stats_fops);
+	}
+	return 0;
+
+fail_cdev:
+	if (cd->teardown)
+		cd->teardown(m->priv, i);
+fail_stats:
+	free_percpu(m->stats);
+fail:
+	dd_chrdev_destroy(cd, i);
+	return ret;
+}
+EXPORT_SYMBOL_GPL(dd_chrdev_register);
+
+void dd_chrdev_unregister(struct dd_chrdev *cd)
+{
+	dd_chrdev_destroy(cd, cd->count);
+}
+EXPORT_SYMBOL_GPL(dd_chrdev_unregister);
+
+/*
+ * /proc files
+ */
+int dd_proc_register(const struct dd_proc *procs, int nr)
+{
+	int i;
+
+	for (i = 0; i < nr; i++) {
+		if (!proc_create_data(procs[i].name, procs[i].mode, NULL,
+				      procs[i].ops, procs[i].data)) {
+			dd_proc_unregister(procs, i);
+			return -ENOMEM;
+		}
+	}
+	return 0;
+}
+EXPORT_SYMBOL_GPL(dd_proc_register);
+
+void dd_proc_unregister(const struct dd_proc *procs, int nr)
+{
+	while (nr--)
+		remove_proc_entry(procs[nr].name, NULL);
+}
+EXPORT_SYMBOL_GPL(dd_proc_unregister);
+
+static int __init dd_core_init(void)
+{
+	dd_class = dd_class_create("dd");
+	if (IS_ERR(dd_class))
+		return PTR_ERR(dd_class);
+	dd_debugfs = debugfs_create_dir("dd", NULL);
+	return 0;
+}
+
+static void __exit dd_core_exit(void)
+{
+	debugfs_remove_recursive(dd_debugfs);
+	class_destroy(dd_class);
+}
+
+module_init(dd_core_init);
+module_exit(dd_core_exit);
@@ -0,0 +1,177 @@
+/*
+ * dd_core.h -- device and /proc registration shared by the dd_primer
+ * modules (dd_core.ko)
+ *
+ * A module describes its character devices in a struct dd_chrdev and its
+ * /proc files in a table of struct dd_proc, and registers each with a
+ * single call. All devices go in the one "dd" class, so their nodes are
+ * /dev/<node> and their attributes /sys/class/dd/<node>/.
+ *
+ *	static struct dd_chrdev ofd_chrdev = {
+ *		.name		= "trivial_dev",
+ *		.node		= "mynull%d",
+ *		.fops		= &ofd_fops,
+ *		.priv_size	= sizeof(struct ofd_dev),
+ *		.setup		= ofd_setup,
+ *	};
+ *
+ *	ofd_chrdev.count = num_devices;
+ *	return dd_chrdev_register(&ofd_chrdev);
+ *
+ * Every minor also gets per-CPU traffic counters and log2 histograms of
+ * request size and latency, which the driver feeds from its fops and
+ * dd_core sums up, in all and per NUMA node, on read of
+ * /sys/kernel/debug/dd/<node>:
+ *
+ *	u64 t0 = ktime_get_ns();
+ *	ret = ofd_store_read(...);
+ *	dd_stat_io(dd_file_stats(filp), DD_READS, ret, t0);
+ */
+
+#ifndef _DD_CORE_H
+#define _DD_CORE_H
+
+#include <linux/kernel.h>
+#include <linux/types.h>
+#include <linux/fs.h>
+#include <linux/cdev.h>
+#include <linux/device.h>
+#include <linux/percpu.h>
+#include <linux/bitops.h>	/* fls64() */
+#include <linux/ktime.h>
+#include <linux/timekeeping.h>
+#include <linux/numa.h>
+#include <linux/topology.h>	/* numa_node_id() */
+
+#include "dd_compat.h"
+
+enum dd_counter {
+	DD_OPENS,
+	DD_READS,
+	DD_WRITES,
+	DD_BYTES_READ,
+	DD_BYTES_WRITTEN,
+	DD_WAITS,		/* times a caller blocked */
+	DD_SPINS,		/* times spinning spared a caller blocking */
+	DD_WAKEUPS,		/* times a caller woke others */
+	DD_EAGAIN,		/* would have blocked, O_NONBLOCK said no */
+	DD_FAULTS,		/* copies to or from user space that faulted */
+	DD_REMOTE,		/* requests served from another node's memory */
+	DD_NR_COUNTERS
+};
+
+/* bucket 0 holds 0, bucket n holds [2^(n-1), 2^n); the last one the rest */
+#define DD_HIST_BUCKETS	48
+
+/* One CPU's view of one minor's traffic; only that CPU writes it */
+struct dd_stats {
+	u64 cnt[DD_NR_COUNTERS];
+	u64 size[2][DD_HIST_BUCKETS];	/* bytes per read, per write */
+	u64 lat[2][DD_HIST_BUCKETS];	/* ns per read, per write */
+};
+
+/* One minor, as dd_core keeps it */
+struct dd_minor {
+	struct cdev cdev;
+	struct device *dev;
+	void *priv;
+	struct dd_stats __percpu *stats;
+	struct dentry *debugfs;
+};
+
+struct dd_chrdev {
+	const char *name;		/* of the region in /proc/devices */
+	const char *node;		/* device name; "%d" stands for the minor */
+	const struct file_operations *fops;
+	const struct attribute_group **groups;	/* on every device, or NULL */
+	int count;			/* minors */
+
+	/*
+	 * Per-minor state: priv_size zeroed bytes per minor, handed to
+	 * setup() before the minor goes live and to teardown() after it is
+	 * gone, and the device's drvdata in between. It is allocated on
+	 * *numa_node if that is given and not NUMA_NO_NODE.
+	 */
+	size_t priv_size;
+	const int *numa_node;
+	int (*setup)(void *priv, int minor);
+	void (*teardown)(void *priv, int minor);
+
+	/* filled in by dd_chrdev_register() */
+	dev_t first;
+	struct dd_minor *minors;
+	void *privs;
+};
+
+int dd_chrdev_register(struct dd_chrdev *cd);
+void dd_chrdev_unregister(struct dd_chrdev *cd);
+
+/* The per-minor state of an open device node */
+static inline void *dd_chrdev_priv(struct inode *inode)
+{
+	return container_of(inode->i_cdev, struct dd_minor, cdev)->priv;
+}
+
+/* The counters of an open device node */
+static inline struct dd_stats __percpu *dd_file_stats(struct file *filp)
+{
+	return container_of(file_inode(filp)->i_cdev, struct dd_minor,
+			    cdev)->stats;
+}
+
+static inline void dd_stat_inc(struct dd_stats __percpu *st,
+			       enum dd_counter c)
+{
+	this_cpu_inc(st->cnt[c]);
+}
+
+static inline int dd_stat_bucket(u64 v)
+{
+	return min_t(int, fls64(v), DD_HIST_BUCKETS - 1);
+}
+
+/* Count a request served from memory on node nid, if that isn't ours */
+static inline void dd_stat_remote(struct dd_stats __percpu *st, int nid)
+{
+	if (nid != NUMA_NO_NODE && nid != numa_node_id())
+		this_cpu_inc(st->cnt[DD_REMOTE]);
+}
+
+/*
+ * Account for a read (op DD_READS) or write (DD_WRITES) that returned ret
+ * and was started at t0, as given by ktime_get_ns()
+ */
+static inline void dd_stat_io(struct dd_stats __percpu *st,
+			      enum dd_counter op, ssize_t ret, u64 t0)
+{
+	int dir = op == DD_WRITES;
+
+	this_cpu_inc(st->cnt[op]);
+	this_cpu_inc(st->lat[dir][dd_stat_bucket(ktime_get_ns() - t0)]);
+	if (ret >= 0) {
+		this_cpu_add(st->cnt[dir ? DD_BYTES_WRITTEN : DD_BYTES_READ],
+			     ret);
+		this_cpu_inc(st->size[dir][dd_stat_bucket(ret)]);
+	} else if (ret == -EAGAIN) {
+		this_cpu_inc(st->cnt[DD_EAGAIN]);
+	} else if (ret == -EFAULT) {
+		this_cpu_inc(st->cnt[DD_FAULTS]);
+	}
+}
+
+struct dd_proc {
+	const char *name;
+	umode_t mode;
+	const struct dd_proc_ops *ops;
+	void *data;			/* pde_data() of the entry */
+};
+
+int dd_proc_register(const struct dd_proc *procs, int nr);
+void dd_proc_unregister(const struct dd_proc *procs, int nr);
+
+#define DD_PROC_REGISTER(_procs)					\
+	dd_proc_register(_procs, ARRAY_SIZE(_procs))
+#define DD_PROC_UNREGISTER(_procs)					\
+	dd_proc_unregister(_procs, ARRAY_SIZE(_procs))
+
+#endif /* _DD_CORE_H */
@@ -0,0 +1,78 @@
+/*
+ * dd_param.h -- module parameters that can be changed while loaded
+ *
+ *	static int delay = HZ;
+ *	DD_PARAM(delay, int, 0, 10 * HZ, NULL);
+ *
+ * works like module_param(delay, int, 0644), except that a value outside
+ * [min, max] is refused with -EINVAL. If the hook is given it runs after
+ * every change, including the ones made at load time, before module_init;
+ * should it fail, the old value is put back and its error returned.
+ * Readers pick the new value up the next time they look.
+ */
+
+#ifndef _DD_PARAM_H
+#define _DD_PARAM_H
+
+#include <linux/kernel.h>
+#include <linux/moduleparam.h>
+
+struct dd_param {
+	void *val;
+	long long min, max;
+	int (*changed)(void);
+};
+
+#define DD_PARAM_OPS(_type, _fmt, _parse)				\
+static int dd_param_set_##_type(const char *buf,			\
+				const struct kernel_param *kp)		\
+{									\
+	const struct dd_param *p = kp->arg;				\
+	_type *val = p->val;						\
+	_type v, old;							\
+	int ret;							\
+									\
+	ret = _parse(buf, 0, &v);					\
+	if (ret)							\
+		return ret;						\
+	if (v < p->min || v > p->max)					\
+		return -EINVAL;						\
+	old = *val;							\
+	WRITE_ONCE(*val, v);						\
+	if (p->changed)							\
+		ret = p->changed();					\
+	if (ret)							\
+		WRITE_ONCE(*val, old);					\
+	return ret;							\
+}									\
+									\
+static int dd_param_get_##_type(char *buf,				\
+				const struct kernel_param *kp)		\
+{									\
+	const struct dd_param *p = kp->arg;				\
+									\
+	return scnprintf(buf, PAGE_SIZE, _fmt "\n",			\
+			 READ_ONCE(*(_type *) p->val));			\
+}									\
+									\
+static const struct kernel_param_ops __maybe_unused dd_param_##_type##_ops = { \
+	.set	= dd_param_set_##_type,					\
+	.get	= dd_param_get_##_type					\
+}
+
+/* uint is linux/types.h's unsigned int, so the names match module_param */
+DD_PARAM_OPS(int, "%d", kstrtoint);
+DD_PARAM_OPS(uint, "%u", kstrtouint);
+
+#define DD_PARAM(_name, _type, _min, _max, _changed)			\
+	param_check_##_type(_name, &(_name));				\
+	static struct dd_param __dd_param_##_name = {			\
+		.val		= &(_name),				\
+		.min		= (_min),				\
+		.max		= (_max),				\
+		.changed	= (_changed)				\
+	};								\
+	module_param_cb(_name, &dd_param_##_type##_ops,		\
+			&__dd_param_##_name, 0644)
+
+#endif /* _DD_PARAM_H */
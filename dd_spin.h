@@ -0,0 +1,137 @@
+/*
+ * dd_spin.h -- spin a little before going to sleep, while that pays off
+ *
+ * A wakeup that comes within a microsecond or two is cheaper to poll for
+ * than to sleep through, which costs a trip through the scheduler on both
+ * sides. How long to poll is learned per device from how long its recent
+ * waits took: twice their moving average, up to max_ns. Waits longer than
+ * that, and spins that ran out of budget, drag the average past max_ns and
+ * spinning stops, until short waits bring it back down. max_ns 0 never
+ * spins, and never reads the clock either.
+ *
+ *	u64 t0 = dd_spin_start(&dev->spin);
+ *
+ *	if (!dd_spin_until(&dev->spin, t0, READ_ONCE(dev->ready)))
+ *		wait_event_interruptible(dev->wq, dev->ready);
+ *	dd_spin_learn(&dev->spin, t0);
+ *
+ * Drivers let it be tuned per device through a spin_ns attribute, which
+ * reads "max <max_ns> avg <avg_ns>" and takes a new max_ns. Builds in user
+ * space too (see userbench/kshim.h).
+ */
+
+#ifndef _DD_SPIN_H
+#define _DD_SPIN_H
+
+#ifdef __KERNEL__
+#include <linux/types.h>
+#include <linux/kernel.h>	/* kstrtouint(), scnprintf() */
+#include <linux/sched.h>	/* need_resched() */
+#include <linux/processor.h>	/* cpu_relax() */
+#include "dd_compat.h"		/* local_clock() */
+#else
+#include "userbench/kshim.h"
+#endif
+
+/* No device gets to spin longer than this, whatever it is told */
+#define DD_SPIN_MAX_NS	1000000
+
+struct dd_spin {
+	unsigned int max_ns;		/* the most to spin for; 0: never */
+	unsigned int avg_ns;		/* how long waits took, on average */
+};
+
+/* A device that hasn't waited yet spins for all it may */
+static inline void dd_spin_init(struct dd_spin *sp, unsigned int max_ns)
+{
+	WRITE_ONCE(sp->max_ns, min_t(unsigned int, max_ns, DD_SPIN_MAX_NS));
+	WRITE_ONCE(sp->avg_ns, sp->max_ns / 2);
+}
+
+static inline u64 dd_spin_budget(const struct dd_spin *sp)
+{
+	u64 max = READ_ONCE(sp->max_ns), avg = READ_ONCE(sp->avg_ns);
+
+	return avg < max ? min(2 * avg, max) : 0;
+}
+
+/* When a wait starts, as dd_spin_until() and dd_spin_learn() want it */
+static inline u64 dd_spin_start(const struct dd_spin *sp)
+{
+	return READ_ONCE(sp->max_ns) ? local_clock() : 0;
+}
+
+/*
+ * The average moves an eighth of the way to each sample; none counts for
+ * more than twice max_ns, so one long sleep doesn't shut spinning off for
+ * good. Waiters race on it, which at worst loses a sample.
+ */
+static inline void dd_spin_sample(struct dd_spin *sp, u64 ns)
+{
+	u64 max = READ_ONCE(sp->max_ns);
+	s64 avg = READ_ONCE(sp->avg_ns);
+
+	if (!max)
+		return;
+	ns = min(ns, 2 * max);
+	WRITE_ONCE(sp->avg_ns, avg + ((s64) ns - avg) / 8);
+}
+
+/* The wait that started at t0 just ended */
+static inline void dd_spin_learn(struct dd_spin *sp, u64 t0)
+{
+	if (READ_ONCE(sp->max_ns))
+		dd_spin_sample(sp, local_clock() - t0);
+}
+
+/*
+ * Polls cond until it holds, or the budget since t0 is spent, or the CPU
+ * is wanted elsewhere; true if cond came to hold. A spin that used up its
+ * budget for nothing counts as a wait as long as it could have been.
+ */
+#define dd_spin_until(sp, t0, cond)					\
+({									\
+	u64 __budget = dd_spin_budget(sp);				\
+	bool __hit = false;						\
+									\
+	while (__budget) {						\
+		if (cond) {						\
+			__hit = true;					\
+			break;						\
+		}							\
+		if (need_resched())					\
+			break;						\
+		if (local_clock() - (t0) >= __budget) {			\
+			dd_spin_sample(sp, U64_MAX);			\
+			break;						\
+		}							\
+		cpu_relax();						\
+	}								\
+	__hit;								\
+})
+
+#ifdef __KERNEL__
+/* For the show() and store() of a device's spin_ns attribute */
+static inline ssize_t dd_spin_show(const struct dd_spin *sp, char *buf)
+{
+	return scnprintf(buf, PAGE_SIZE, "max %u avg %u\n",
+			 READ_ONCE(sp->max_ns), READ_ONCE(sp->avg_ns));
+}
+
+static inline ssize_t dd_spin_store(struct dd_spin *sp, const char *buf,
+				    size_t count)
+{
+	unsigned int ns;
+	int ret;
+
+	ret = kstrtouint(buf, 0, &ns);
+	if (ret)
+		return ret;
+	if (ns > DD_SPIN_MAX_NS)
+		return -EINVAL;
+	dd_spin_init(sp, ns);
+	return count;
+}
+#endif
+
+#endif /* _DD_SPIN_H */
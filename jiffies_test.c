@@ -13,9 +13,9 @@
 #include <linux/uaccess.h>	/* copy_to_user and copy_from_user */
 #include <linux/jiffies.h>
 
-static dev_t first;		/* Global var. for first dev number */
-static struct cdev c_dev;	/* Global variable for the char device structure */
-static struct class *cl;	/* Global variable for the device class */
+#include "dd_compat.h"
+#include "dd_core.h"
+
 
 /*
  * Open and Close
@@ -103,33 +103,22 @@ static struct file_operations ofd_fops = {
 	.write	 = ofd_write
 };
 
+static struct dd_chrdev ofd_chrdev = {
+	.name		= "trivial_dev",
+	.node		= "jiffies_test",
+	.fops		= &ofd_fops,
+	.count		= 1
+};
+
 static int __init ofd_init(void)	/* constructor */
 {
-	printk(KERN_INFO "Bonjour! ofd registred");
-
-	if (alloc_chrdev_region(&first, 0, 1, "trivial_dev") < 0)
-		return -1;
+	int ret;
 
-	if ((cl = class_create(THIS_MODULE, "chardrv")) == NULL) {
-		unregister_chrdev_region(first, 1);
-		return -1;
-	}
-
-	if (device_create(cl, NULL, first, NULL, "mynull") == NULL) {
-		class_destroy(cl);
-		unregister_chrdev_region(first, 1);
-		return -1;
-	}
+	printk(KERN_INFO "Bonjour! ofd registred");
 
-	/* initialize the char device structure */
-	cdev_init(&c_dev, &ofd_fops);
-	if (cdev_add(&c_dev, first, 1) == -1) {
-		device_destroy(cl, first);
-		class_destroy(cl);
-		unregister_chrdev_region(first, 1);
-		return -1;
-	}
-	//printk(KERN_INFO "<Major, Minor>: <%d, %d>\n", MAJOR(first), MINOR(first));
+	ret = dd_chrdev_register(&ofd_chrdev);
+	if (ret)
+		return ret;
 	timer_stuff();
 
 	return 0;
@@ -137,10 +126,7 @@ static int __init ofd_init(void)	/* constructor */
 
 static void __exit ofd_exit(void)	/* destructor */
 {
-	cdev_del(&c_dev);
-	device_destroy(cl, first);
-	class_destroy(cl);
-	unregister_chrdev_region(first, 1);
+	dd_chrdev_unregister(&ofd_chrdev);
 	printk(KERN_INFO "Au revour! ofd unregistered");
 }
 
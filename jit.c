@@ -14,19 +14,30 @@
 #include <linux/types.h>
 #include <linux/spinlock.h>
 #include <linux/interrupt.h>
+#include <linux/slab.h>
 #include <linux/sched.h>	/* schedule() */
+#include <linux/kthread.h>
+#include <linux/list.h>
+#include <linux/atomic.h>
 
 #include <asm/hardirq.h>
 
+#include "dd_compat.h"
+#include "dd_core.h"
+#include "dd_param.h"
+#include "jit_stream.h"
+
 /*
  * This module is a silly one: it only embeds short code fragments that show
  * how time delays can be handled in the kernel.
  */
 
-int jit_nr_devs = 5;	/* Temporary fix; determines no. of lines return by `cat` */
+/* lines per open; 0 streams until the reader closes */
+static unsigned int nr_lines = 5;
 int delay	= HZ;		/* the default delay, expressed in jiffies */
 
-module_param(delay, int, 0);
+DD_PARAM(delay, int, 0, 60 * HZ, NULL);
+DD_PARAM(nr_lines, uint, 0, UINT_MAX, NULL);
 
 MODULE_AUTHOR("Salym Senyonga");
 MODULE_LICENSE("GPL");
@@ -43,67 +54,17 @@ enum jit_files {
  * /proc fs stuff : using seq_file
  */
 
-/* The sequence iteration methods */
-static void *jit_seq_start(struct seq_file *s, loff_t *pos)
-{
-	if (*pos >= jit_nr_devs)
-		return NULL;
-	return jit_nr_devs + *pos;
-}
-
-static void *jit_seq_next(struct seq_file *s, void *v, loff_t *pos)
+/* Takes one sample */
+static int jit_seq_sample(char *buf, size_t len, void *data)
 {
-	if (++(*pos) >= jit_nr_devs)
-		return NULL;
-	return jit_nr_devs + *pos;
+	return scnprintf(buf, len, "Jit Proc File Operational\n");
 }
 
-static void jit_seq_stop(struct seq_file *s, void *v)
-{
-}
-
-static int jit_seq_show(struct seq_file *s, void *v)
-{
-	seq_printf(s, "Jit Proc File Operational\n");
-	return 0;
-}
-
-/* build up the seq_ops structure */
-static struct seq_operations jit_seq_ops = {
-	.start	= jit_seq_start,
-	.next	= jit_seq_next,
-	.stop	= jit_seq_stop,
-	.show	= jit_seq_show
-};
-
-/* the open() method that connects the /proc file the the seq_ops */
-static int jit_proc_open(struct inode *inode, struct file *file)
-{
-	return seq_open(file, &jit_seq_ops);
-}
-
-/* Initialize a fops structure for the /proc file. Required by the seq_file
- * interface. We only are concerned about the open() method
- */
-
-static struct file_operations jit_proc_ops = {
-	.owner		= THIS_MODULE,
-	.open		= jit_proc_open,
-	.read		= seq_read,
-	.llseek		= seq_lseek,
-	.release	= seq_release
+/* What the /proc file streams, see jit_stream.h */
+static struct jit_source jit_src = {
+	"jitseq", jit_seq_sample, NULL, &nr_lines
 };
 
-static void jit_create_proc(void)
-{
-	struct proc_dir_entry *entry;
-	entry = proc_create_data("jitseq", 0, NULL, &jit_proc_ops, NULL);
-}
-
-static void jit_remove_proc(void)
-{
-	remove_proc_entry("jitseq", NULL);
-}
 /*
  * This function prints one line of data, after sleeping one second. It can
  * sleep in different ways, according to the data pointer
@@ -148,185 +109,274 @@ int jit_fn(char *buf, char **start, off_t offset, int len, int *eof, void *data)
 int jit_currenttime(char *buf, char **start, off_t offset, int len, int *eof,
 		void *data)
 {
-	struct timeval tv1;
-	struct timespec tv2;
+	struct timespec64 tv1, tv2;
 	unsigned long j1;
 	u64 j2;
 
 	j1 = jiffies;
 	j2 = get_jiffies_64();
-	do_gettimeofday(&tv1);
-	tv2 = current_kernel_time();
+	ktime_get_real_ts64(&tv1);
+	ktime_get_coarse_real_ts64(&tv2);
 
 	/* print */
 	len = 0;
 	len += sprintf(buf, "0x%08lx 0x%016Lx %10i.%06i\n" "%40i.%09i\n", j1,
-			j2, (int) tv1.tv_sec, (int) tv1.tv_usec,
+			j2, (int) tv1.tv_sec, (int) (tv1.tv_nsec / NSEC_PER_USEC),
 			(int) tv2.tv_sec, (int) tv2.tv_nsec);
 	*start = buf;
 	return len;
 }
 
 /*
- * The timer example follows
+ * The timer and tasklet examples follow
+ *
+ * Each sample schedules a timer `tdelay` jiffies ahead, or a tasklet, and
+ * prints what the callback saw:
+ *
+ *	time delta inirq pid cpu command
+ *
+ * The measurement contexts come from a pool of `pool_size` preallocated
+ * ones, so sampling doesn't touch the allocator; only when all are in use
+ * is one taken from the jit_data slab cache, and counted in /proc/jitpool.
  */
 
 int tdelay = 10;
-module_param(tdelay, int, 0);
+DD_PARAM(tdelay, int, 1, 60 * HZ, NULL);
+
+static unsigned int pool_size = 16;	/* contexts kept ready */
+module_param(pool_size, uint, 0444);
+
+enum jit_async {
+	JIT_TIMER,
+	JIT_TASKLET,
+	JIT_TASKLET_HI
+};
 
 /* This data structure used as "data" for the timer and tasklet functions */
 struct jit_data {
 	struct timer_list timer;
 	struct tasklet_struct tlet;
-	int hi;				/* tasklet or tasklet_hi */
 	wait_queue_head_t wait;
-	unsigned long prev_jiffies;
-	unsigned char *buf;
-	int loops;
+	struct list_head list;		/* in the pool while free */
+	bool done;			/* the callback has run */
+
+	/* what the callback saw */
+	unsigned long fired;		/* jiffies */
+	int inirq;
+	pid_t pid;
+	int cpu;
+	char comm[TASK_COMM_LEN];
 };
 
-#define JIT_ASYNC_LOOPS 5
+static struct kmem_cache *jit_cache;
+static LIST_HEAD(jit_pool);
+static DEFINE_SPINLOCK(jit_pool_lock);
+static unsigned int jit_pool_free;		/* under jit_pool_lock */
+static atomic_long_t jit_pool_hits;
+static atomic_long_t jit_pool_misses;		/* pool empty, went to slab */
 
-void jit_timer_fn(unsigned long arg)
+static void jit_callback(struct jit_data *data)
 {
-	struct jit_data *data = (struct jit_data *) arg;
-	unsigned long j = jiffies;
-	data->buf += sprintf(data->buf, "%9li %3li %i %6i %i %s\n", j,
-			     j - data->prev_jiffies, in_interrupt() ? 1 : 0,
-			     current->pid, smp_processor_id(), current->comm);
-
-	if (--data->loops) {
-		data->timer.expires += tdelay;
-		data->prev_jiffies = j;
-		add_timer(&data->timer);
-	}
-	else {
-		wake_up_interruptible(&data->wait);
-	}
+	data->fired	= jiffies;
+	data->inirq	= in_interrupt() ? 1 : 0;
+	data->pid	= current->pid;
+	data->cpu	= smp_processor_id();
+	memcpy(data->comm, current->comm, sizeof(data->comm));
+
+	WRITE_ONCE(data->done, true);
+	wake_up_interruptible(&data->wait);
 }
 
-/* the /proc function: allocate everything to allow concurrency */
-int jit_timer(char *buf, char **start, off_t offset, int len, int *eof,
-	      void *unused_data)
+static void jit_timer_fn(struct timer_list *t)
+{
+	struct jit_data *data = timer_container_of(data, t, timer);
+
+	jit_callback(data);
+}
+
+static void jit_tasklet_fn(struct tasklet_struct *t)
+{
+	struct jit_data *data = from_tasklet(data, t, tlet);
+
+	jit_callback(data);
+}
+
+static struct jit_data *jit_data_alloc(void)
 {
 	struct jit_data *data;
-	char *buf2 = buf;
-	unsigned long j = jiffies;
 
-	data = kmalloc(sizeof(*data), GFP_KERNEL);
+	data = kmem_cache_alloc(jit_cache, GFP_KERNEL);
 	if (!data)
-		return -ENOMEM;
-
-	init_timer(&data->timer);
+		return NULL;
+	timer_setup(&data->timer, jit_timer_fn, 0);
+	tasklet_setup(&data->tlet, jit_tasklet_fn);
 	init_waitqueue_head(&data->wait);
-
-	/* write the first lines in the buffer */
-	buf2 += sprintf(buf2, " time	delta	inirq	pid	cpu	command\n");
-	buf2 += sprintf(buf2, "%9li	%3li	%i	%6i	%i	%s\n",
-			j, 0L, in_interrupt() ? 1 : 0, current->pid,
-			smp_processor_id(), current->comm);
-
-	/* fill the data for our timer function */
-	data->prev_jiffies	= j;
-	data->buf		= buf2;
-	data->loops = JIT_ASYNC_LOOPS;
-
-	/* register the timer */
-	data->timer.data	= (unsigned long) data;
-	data->timer.function	= jit_timer_fn;
-	data->timer.expires	= j + tdelay;	/* parameter */
-	add_timer(&data->timer);
-
-	/* wait for the buffer to fill */
-	wait_event_interruptible(data->wait, !data->loops);
-	if (signal_pending(current))
-		return -ERESTARTSYS;
-	buf2 = data->buf;
-	kfree(data);
-	*eof = 1;
-	return buf2 - buf;
+	return data;
 }
 
-void jit_tasklet_fn(unsigned long arg)
+static struct jit_data *jit_data_get(void)
 {
-	struct jit_data *data = (struct jit_data *) arg;
-	unsigned long j = jiffies;
-	data->buf += sprintf(data->buf, "%9li	%3li	%i	%6i	%i	%s\n",
-			     j, j - data->prev_jiffies, in_interrupt() ? 1 : 0,
-			     current->pid, smp_processor_id(), current->comm);
-
-	if (--data->loops) {
-		data->prev_jiffies = j;
-		if (data->hi)
-			tasklet_hi_schedule(&data->tlet);
-		else
-			tasklet_schedule(&data->tlet);
+	struct jit_data *data = NULL;
+
+	spin_lock(&jit_pool_lock);
+	if (!list_empty(&jit_pool)) {
+		data = list_first_entry(&jit_pool, struct jit_data, list);
+		list_del(&data->list);
+		jit_pool_free--;
+	}
+	spin_unlock(&jit_pool_lock);
+
+	if (data) {
+		atomic_long_inc(&jit_pool_hits);
+		return data;
 	}
-	else {
-		wake_up_interruptible(&data->wait);
+	atomic_long_inc(&jit_pool_misses);
+	return jit_data_alloc();
+}
+
+/* Only once its timer and tasklet are idle */
+static void jit_data_put(struct jit_data *data)
+{
+	spin_lock(&jit_pool_lock);
+	if (jit_pool_free < pool_size) {
+		list_add(&data->list, &jit_pool);
+		jit_pool_free++;
+		data = NULL;
 	}
+	spin_unlock(&jit_pool_lock);
+
+	if (data)
+		kmem_cache_free(jit_cache, data);
+}
+
+static void jit_pool_destroy(void)
+{
+	struct jit_data *data, *tmp;
+
+	list_for_each_entry_safe(data, tmp, &jit_pool, list)
+		kmem_cache_free(jit_cache, data);
+	INIT_LIST_HEAD(&jit_pool);
+	jit_pool_free = 0;
+	kmem_cache_destroy(jit_cache);
 }
 
-/* The /proc function: allocate everything to allow concurrency */
-int jit_tasklet(char *buf, char **start, off_t offset, int len, int *eof,
-		void *arg)
+static int jit_pool_fill(void)
 {
 	struct jit_data *data;
-	char *buf2 = buf;
-	unsigned long j = jiffies;
-	long hi = (long) arg;
 
-	data = kmalloc(sizeof(*data), GFP_KERNEL);
-	if (!data)
+	jit_cache = KMEM_CACHE(jit_data, 0);
+	if (!jit_cache)
 		return -ENOMEM;
 
-	init_waitqueue_head(&data->wait);
+	while (jit_pool_free < pool_size) {
+		data = jit_data_alloc();
+		if (!data) {
+			jit_pool_destroy();
+			return -ENOMEM;
+		}
+		list_add(&data->list, &jit_pool);
+		jit_pool_free++;
+	}
+	return 0;
+}
+
+/* Takes one sample, in the stream's kthread */
+static int jit_async_sample(char *buf, size_t len, void *arg)
+{
+	long kind = (long) arg;
+	struct jit_data *data;
+	unsigned long j;
+	int n = -EINTR;		/* stopped before the callback ran */
+
+	data = jit_data_get();
+	if (!data)
+		return scnprintf(buf, len, "%9lu out of memory\n", jiffies);
 
-	/* write the first lines in the buffer */
-	buf2 += sprintf(buf2, "	time	delta	inirq	pid	cpu	command\n");
-	buf2 += sprintf(buf2, "	%9li	%3li	%i	%6i	%i	%s\n",
-			j, 0L, in_interrupt() ? 1 : 0, current->pid,
-			smp_processor_id(), current->comm);
-
-	/* fill the data for our tasklet function */
-	data->prev_jiffies = j;
-	data->buf	= buf2;
-	data->loops	= JIT_ASYNC_LOOPS;
-
-	/* register the tasklet */
-	tasklet_init(&data->tlet, jit_tasklet_fn, (unsigned long) data);
-	data->hi = hi;
-	if (hi)
+	data->done = false;
+	j = jiffies;
+	if (kind == JIT_TIMER)
+		mod_timer(&data->timer, j + READ_ONCE(tdelay));
+	else if (kind == JIT_TASKLET_HI)
 		tasklet_hi_schedule(&data->tlet);
 	else
 		tasklet_schedule(&data->tlet);
 
-	/* wait for the buffer to fill */
-	wait_event_interruptible(data->wait, !data->loops);
+	/* kthread_stop() wakes us too */
+	wait_event_interruptible(data->wait, READ_ONCE(data->done) ||
+				 kthread_should_stop());
 
-	if (signal_pending(current))
-		return -ERESTARTSYS;
-	buf2 = data->buf;
-	kfree(data);
-	*eof = 1;
-	return buf2 - buf;
+	/* whether it ran or not, it mustn't be running once back in the pool */
+	if (kind == JIT_TIMER)
+		timer_delete_sync(&data->timer);
+	else
+		tasklet_kill(&data->tlet);
+
+	if (data->done)
+		n = scnprintf(buf, len, "%9lu %3lu %i %6i %i %s\n",
+			      data->fired, data->fired - j, data->inirq,
+			      data->pid, data->cpu, data->comm);
+	jit_data_put(data);
+	return n;
 }
 
+static int jit_pool_show(struct seq_file *m, void *v)
+{
+	unsigned int free;
+
+	spin_lock(&jit_pool_lock);
+	free = jit_pool_free;
+	spin_unlock(&jit_pool_lock);
+
+	seq_printf(m, "size %u free %u hits %lu misses %lu\n", pool_size, free,
+		   atomic_long_read(&jit_pool_hits),
+		   atomic_long_read(&jit_pool_misses));
+	return 0;
+}
+
+static int jit_pool_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, jit_pool_show, NULL);
+}
+
+static const struct dd_proc_ops jit_pool_proc_ops = {
+	DD_PROC_OPS(jit_pool_open, seq_read, NULL, seq_lseek, single_release)
+};
+
+static struct jit_source jit_timer_src = {
+	"jittimer", jit_async_sample, (void *) JIT_TIMER, &nr_lines
+};
+static struct jit_source jit_tasklet_src = {
+	"jittasklet", jit_async_sample, (void *) JIT_TASKLET, &nr_lines
+};
+static struct jit_source jit_tasklet_hi_src = {
+	"jittasklethi", jit_async_sample, (void *) JIT_TASKLET_HI, &nr_lines
+};
+
+static const struct dd_proc jit_procs[] = {
+	{ "jitseq",	  0644, &jit_stream_proc_ops, &jit_src },
+	{ "jittimer",	  0644, &jit_stream_proc_ops, &jit_timer_src },
+	{ "jittasklet",	  0644, &jit_stream_proc_ops, &jit_tasklet_src },
+	{ "jittasklethi", 0644, &jit_stream_proc_ops, &jit_tasklet_hi_src },
+	{ "jitpool",	  0444, &jit_pool_proc_ops, NULL },
+};
+
 int __init jit_init(void)
 {
+	int ret;
+
 	/*create_proc_read_entry("currenttime", 0, NULL, jit_currenttime, NULL);
 	create_proc_read_entry("jitbusy", 0, NULL, jit_fn, (void *)JIT_BUSY);
 	create_proc_read_entry("jitsched",0, NULL, jit_fn, (void *)JIT_SCHED);
 	create_proc_read_entry("jitqueue",0, NULL, jit_fn, (void *)JIT_QUEUE);
 	create_proc_read_entry("jitschedto", 0, NULL, jit_fn, (void *)JIT_SCHEDTO);
-
-	create_proc_read_entry("jittimer", 0, NULL, jit_timer, NULL);
-	create_proc_read_entry("jittasklet", 0, NULL, jit_tasklet, NULL);
-	create_proc_read_entry("jittasklethi", 0, NULL, jit_tasklet, (void *)1);
 	*/
-	jit_create_proc();
-
-	return 0; /* success */
+	ret = jit_pool_fill();
+	if (ret)
+		return ret;
+	ret = DD_PROC_REGISTER(jit_procs);
+	if (ret)
+		jit_pool_destroy();
+	return ret;
 }
 
 void __exit jit_cleanup(void)
@@ -336,11 +386,9 @@ void __exit jit_cleanup(void)
 	remove_proc_entry("jitsched", NULL);
 	remove_proc_entry("jitqueue", NULL);
 	remove_proc_entry("jitschedto", NULL);
-	remove_proc_entry("jittimer", NULL);
-	remove_proc_entry("jittasklet", NULL);
-	remove_proc_entry("jittasklet_hi", NULL);
 	*/
-	jit_remove_proc();
+	DD_PROC_UNREGISTER(jit_procs);
+	jit_pool_destroy();
 }
 
 module_init(jit_init);
@@ -4,8 +4,19 @@
  * This module creates a /proc file named "cur_time", which
  * returns the following items, in ASCII, when read:
  * - The current `jiffies` and `jiffies_64` values as hex numbers
- * - The current time as returned by `do_gettimeofday
- * - The timespec returned by `current_kernel_time`
+ * - The current time as returned by `ktime_get_real_ts64`
+ * - The coarse (tick granular) time from `ktime_get_coarse_real_ts64`
+ *
+ * A second file, "cur_time_bench", benchmarks the time APIs themselves: for
+ * every clock it reports the cost per call, the smallest step observed
+ * between two consecutive reads and the number of times a read on one CPU
+ * returned a value older than the latest one seen on any CPU. A read keeps
+ * every CPU busy for a while, so only root may.
+ *
+ * A third file, "cur_time_skew", holds a matrix with one row per CPU: each
+ * cell is the offset of the column CPU's clock from the row CPU's clock and
+ * the round trip it was measured over, both in the clock's own units. It
+ * keeps two CPUs spinning per cell, so it is root's too.
  */
 
 #include <linux/module.h>
@@ -21,13 +32,38 @@
 #include <linux/spinlock.h>
 #include <linux/interrupt.h>
 #include <linux/sched.h>	/* schedule() */
+#include <linux/ktime.h>
+#include <linux/math64.h>	/* div_u64() */
+#include <linux/percpu.h>
+#include <linux/mutex.h>
+#include <linux/workqueue.h>	/* schedule_on_each_cpu() */
+#include <linux/kthread.h>
+#include <linux/cpumask.h>
+#include <linux/string.h>
 
 #include <asm/hardirq.h>
+#include <asm/timex.h>		/* get_cycles() */
 
-int jit_line_limit	= 5;	/* Temporary fix; determines no. of lines returned by `cat` */
+#include "dd_compat.h"
+#include "dd_core.h"
+#include "dd_param.h"
+#include "jit_stream.h"
+
+/* lines per open; 0 streams until the reader closes */
+static unsigned int nr_lines = 5;
 int delay		= HZ;	/* the default delay, expressed in jiffies */
 
-module_param(delay, int, 0);
+int bench_loops		= 1000000;	/* timed calls per CPU, per clock */
+int warp_loops		= 10000;	/* serialised reads per CPU, per clock */
+
+DD_PARAM(delay, int, 0, 60 * HZ, NULL);
+DD_PARAM(nr_lines, uint, 0, UINT_MAX, NULL);
+DD_PARAM(bench_loops, int, 1, 100000000, NULL);
+DD_PARAM(warp_loops, int, 1, 10000000, NULL);
+
+int skew_rounds		= 1000;		/* ping-pongs per pair of CPUs */
+
+DD_PARAM(skew_rounds, int, 1, 1000000, NULL);
 
 MODULE_AUTHOR("Salym Senyonga");
 MODULE_LICENSE("GPL");
@@ -36,90 +72,496 @@ MODULE_LICENSE("GPL");
  * /proc fs stuff : using seq_file
  */
 
-/* The sequence iteration methods */
-static void *jit_seq_start(struct seq_file *s, loff_t *pos)
+static void jit_seq_stop(struct seq_file *s, void *v)
 {
-	if (*pos >= jit_line_limit)
-		return NULL;
-	return jit_line_limit + *pos;
 }
 
-static void *jit_seq_next(struct seq_file *s, void *v, loff_t *pos)
+/* Takes one sample of the current time */
+static int jit_cur_time_sample(char *buf, size_t len, void *data)
 {
-	if (++(*pos) >= jit_line_limit)
+	struct timespec64 tv1, tv2;
+	unsigned long j1;
+	u64 j2;
+
+	j1 = jiffies;
+	j2 = get_jiffies_64();
+	ktime_get_real_ts64(&tv1);
+	ktime_get_coarse_real_ts64(&tv2);
+
+	return scnprintf(buf, len, "0x%08lx	0x%016Lx	%10i.%06i\n	%40i.%09i\n",
+		     j1,	j2,     (int) tv1.tv_sec,
+		     (int) (tv1.tv_nsec / NSEC_PER_USEC),
+		     (int) tv2.tv_sec,	(int) tv2.tv_nsec);
+}
+
+/* What /proc/cur_time streams, see jit_stream.h */
+static struct jit_source jit_src = {
+	"cur_time", jit_cur_time_sample, NULL, &nr_lines
+};
+
+/*
+ * Clock benchmark : /proc/cur_time_bench
+ */
+
+/* What one CPU measured for the clock under test */
+struct jit_clock_result {
+	u64 elapsed_ns;		/* time spent in the timed loop */
+	u64 resolution;		/* smallest non-zero step, in clock units */
+	unsigned long warps;	/* reads older than the latest published one */
+};
+
+struct jit_clock {
+	const char *name;
+	const char *unit;
+	u64 (*read)(void);
+	void (*bench)(struct jit_clock_result *r);
+	void (*warp)(struct jit_clock_result *r);
+};
+
+static DEFINE_PER_CPU(struct jit_clock_result, jit_clock_res);
+static DEFINE_MUTEX(jit_bench_mutex);		/* one benchmark at a time */
+static const struct jit_clock *jit_bench_clock;	/* the clock under test */
+
+static DEFINE_SPINLOCK(jit_warp_lock);
+static u64 jit_warp_last;			/* latest value read by any CPU */
+
+/*
+ * Every clock gets its own copy of the loops, so the call being measured is
+ * inlined rather than made through a function pointer. The timed loop also
+ * tracks the smallest step, which keeps the compiler from dropping the reads
+ * and costs the same few instructions for every clock.
+ *
+ * The warp loop reads the clock under a global lock, so a value smaller than
+ * the last one published means a CPU saw time go backwards. Interrupts stay
+ * on for it: one on the lock holder only delays the others.
+ *
+ * Both give the CPU up every JIT_RESCHED_LOOPS iterations, as the loop
+ * counts are in the millions.
+ */
+#define JIT_RESCHED_LOOPS	4096
+
+
+#define JIT_CLOCK(_name, _expr)						\
+static u64 jit_read_##_name(void)					\
+{									\
+	return (_expr);							\
+}									\
+									\
+static void jit_bench_##_name(struct jit_clock_result *r)		\
+{									\
+	u64 prev, now, step, res = ~0ULL;				\
+	ktime_t t0;							\
+	int i;								\
+									\
+	t0 = ktime_get();						\
+	prev = (_expr);							\
+	for (i = 0; i < bench_loops; i++) {				\
+		now = (_expr);						\
+		step = now - prev;					\
+		if (step && step < res)					\
+			res = step;					\
+		prev = now;						\
+		if (!(i % JIT_RESCHED_LOOPS))				\
+			cond_resched();					\
+	}								\
+	r->elapsed_ns = ktime_to_ns(ktime_sub(ktime_get(), t0));	\
+	r->resolution = res;						\
+}									\
+									\
+static void jit_warp_##_name(struct jit_clock_result *r)		\
+{									\
+	u64 now;							\
+	int i;								\
+									\
+	for (i = 0; i < warp_loops; i++) {				\
+		spin_lock(&jit_warp_lock);				\
+		now = (_expr);						\
+		if (now < jit_warp_last)				\
+			r->warps++;					\
+		else							\
+			jit_warp_last = now;				\
+		spin_unlock(&jit_warp_lock);				\
+		if (!(i % JIT_RESCHED_LOOPS))				\
+			cond_resched();					\
+	}								\
+}
+
+JIT_CLOCK(jiffies,		(u64) jiffies)
+JIT_CLOCK(get_jiffies_64,	get_jiffies_64())
+JIT_CLOCK(ktime_get,		ktime_to_ns(ktime_get()))
+JIT_CLOCK(ktime_get_coarse,	ktime_get_coarse_ns())
+JIT_CLOCK(ktime_get_real,	ktime_to_ns(ktime_get_real()))
+JIT_CLOCK(ktime_get_ns,		ktime_get_ns())
+JIT_CLOCK(local_clock,		local_clock())
+JIT_CLOCK(sched_clock,		sched_clock())
+JIT_CLOCK(get_cycles,		(u64) get_cycles())	/* rdtsc on x86 */
+
+#define JIT_CLOCK_ENTRY(_name, _unit) {					\
+	.name	= #_name,						\
+	.unit	= _unit,						\
+	.read	= jit_read_##_name,					\
+	.bench	= jit_bench_##_name,					\
+	.warp	= jit_warp_##_name					\
+}
+
+static const struct jit_clock jit_clocks[] = {
+	JIT_CLOCK_ENTRY(jiffies,		"jiffy"),
+	JIT_CLOCK_ENTRY(get_jiffies_64,		"jiffy"),
+	JIT_CLOCK_ENTRY(ktime_get,		"ns"),
+	JIT_CLOCK_ENTRY(ktime_get_coarse,	"ns"),
+	JIT_CLOCK_ENTRY(ktime_get_real,		"ns"),
+	JIT_CLOCK_ENTRY(ktime_get_ns,		"ns"),
+	JIT_CLOCK_ENTRY(local_clock,		"ns"),
+	JIT_CLOCK_ENTRY(sched_clock,		"ns"),
+	JIT_CLOCK_ENTRY(get_cycles,		"cycle")
+};
+
+/* Run on every online CPU at once, so shared clock state sees contention */
+static void jit_bench_work(struct work_struct *work)
+{
+	jit_bench_clock->bench(per_cpu_ptr(&jit_clock_res,
+					   raw_smp_processor_id()));
+}
+
+static void jit_warp_work(struct work_struct *work)
+{
+	jit_bench_clock->warp(per_cpu_ptr(&jit_clock_res,
+					  raw_smp_processor_id()));
+}
+
+/* The first line is a header, then one line per entry of jit_clocks[] */
+static void *jit_bench_seq_start(struct seq_file *s, loff_t *pos)
+{
+	if (*pos == 0)
+		return SEQ_START_TOKEN;
+	if (*pos > ARRAY_SIZE(jit_clocks))
 		return NULL;
-	return jit_line_limit + *pos;
+	return (void *) &jit_clocks[*pos - 1];
 }
 
-static void jit_seq_stop(struct seq_file *s, void *v)
+static void *jit_bench_seq_next(struct seq_file *s, void *v, loff_t *pos)
 {
+	++(*pos);
+	return jit_bench_seq_start(s, pos);
 }
 
-static int jit_seq_show(struct seq_file *s, void *v)
+static int jit_bench_seq_show(struct seq_file *s, void *v)
 {
-	struct timeval tv1;
-	struct timespec tv2;
-	unsigned long j1;
-	u64 j2;
+	const struct jit_clock *clk = v;
+	struct jit_clock_result *r;
+	u64 fast = ~0ULL, slow = 0, sum = 0, res = ~0ULL;
+	unsigned long warps = 0;
+	int cpu, nr_cpus = 0;
 
-	j1 = jiffies;
-	j2 = get_jiffies_64();
-	do_gettimeofday(&tv1);
-	tv2 = current_kernel_time();
+	if (v == SEQ_START_TOKEN) {
+		seq_printf(s, "%-18s %-6s %10s %10s %10s %10s %8s\n",
+			   "clock", "unit", "min ns", "avg ns", "max ns",
+			   "resolution", "warps");
+		return 0;
+	}
+	if (bench_loops <= 0)
+		return -EINVAL;
 
-	seq_printf(s, "0x%08lx	0x%016Lx	%10i.%06i\n	%40i.%09i\n",
-		     j1,	j2,     (int) tv1.tv_sec, (int) tv1.tv_usec,
-		     (int) tv2.tv_sec,	(int) tv2.tv_nsec);
+	mutex_lock(&jit_bench_mutex);
+	for_each_possible_cpu(cpu)
+		memset(per_cpu_ptr(&jit_clock_res, cpu), 0, sizeof(*r));
+	jit_bench_clock = clk;
+	jit_warp_last	= 0;
+	schedule_on_each_cpu(jit_bench_work);
+	schedule_on_each_cpu(jit_warp_work);
+
+	for_each_online_cpu(cpu) {
+		r = per_cpu_ptr(&jit_clock_res, cpu);
+		fast	= min(fast, r->elapsed_ns);
+		slow	= max(slow, r->elapsed_ns);
+		sum	+= r->elapsed_ns;
+		res	= min(res, r->resolution);
+		warps	+= r->warps;
+		nr_cpus++;
+	}
+	mutex_unlock(&jit_bench_mutex);
+
+	/* per-call costs, in hundredths of a nanosecond */
+	fast = div_u64(fast * 100, bench_loops);
+	slow = div_u64(slow * 100, bench_loops);
+	sum  = div_u64(div_u64(sum * 100, nr_cpus), bench_loops);
+
+	seq_printf(s, "%-18s %-6s %7llu.%02llu %7llu.%02llu %7llu.%02llu ",
+		   clk->name, clk->unit, fast / 100, fast % 100,
+		   sum / 100, sum % 100, slow / 100, slow % 100);
+	if (res == ~0ULL)	/* never ticked during the run */
+		seq_printf(s, "%10s %8lu\n", "-", warps);
+	else
+		seq_printf(s, "%10llu %8lu\n", res, warps);
 	return 0;
 }
 
-/* build up the seq_ops structure */
-static struct seq_operations jit_seq_ops = {
-	.start	= jit_seq_start,
-	.next	= jit_seq_next,
+static struct seq_operations jit_bench_seq_ops = {
+	.start	= jit_bench_seq_start,
+	.next	= jit_bench_seq_next,
 	.stop	= jit_seq_stop,
-	.show	= jit_seq_show
+	.show	= jit_bench_seq_show
+};
+
+static int jit_bench_proc_open(struct inode *inode, struct file *file)
+{
+	return seq_open(file, &jit_bench_seq_ops);
+}
+
+static const struct dd_proc_ops jit_bench_proc_ops = {
+	DD_PROC_OPS(jit_bench_proc_open, seq_read, NULL, seq_lseek,
+		    seq_release)
+};
+
+/*
+ * Cross-CPU skew probe : /proc/cur_time_skew
+ *
+ * For a pair of CPUs (a, b), a worker on `a` posts a sequence number and a
+ * kthread pinned on `b` answers with a reading of its own clock. Of all the
+ * rounds, the one with the shortest round trip bounds the error best, and
+ * b's offset from a is estimated as t_b - (t_a0 + t_a1) / 2. A round that
+ * takes longer than JIT_SKEW_TIMEOUT ends the probe of the pair.
+ */
+#define JIT_SKEW_TIMEOUT	HZ
+
+struct jit_skew_probe {
+	const struct jit_clock *clk;
+	int rounds;
+	int aborted;			/* the initiator gave up */
+
+	unsigned long ping ____cacheline_aligned_in_smp;	/* a -> b */
+	unsigned long pong ____cacheline_aligned_in_smp;	/* b -> a */
+	u64 pong_ts;
+
+	s64 offset ____cacheline_aligned_in_smp;
+	u64 rtt;
+};
+
+/* The probe is only used under jit_bench_mutex */
+static struct jit_skew_probe jit_skew;
+
+/* The per-open iterator: the CPU whose row is being printed */
+struct jit_skew_iter {
+	int cpu;
+	const struct jit_clock *clk;	/* picked when the header is shown */
 };
 
-/* the open() method that connects the /proc file the the seq_ops */
-static int jit_proc_open(struct inode *inode, struct file *file)
+static int jit_skew_responder(void *arg)
 {
-	return seq_open(file, &jit_seq_ops);
+	struct jit_skew_probe *p = arg;
+	unsigned long seq;
+
+	for (seq = 1; seq <= p->rounds; seq++) {
+		while (smp_load_acquire(&p->ping) != seq) {
+			if (smp_load_acquire(&p->aborted) ||
+			    kthread_should_stop())
+				goto out;
+			cpu_relax();
+		}
+		p->pong_ts = p->clk->read();
+		smp_store_release(&p->pong, seq);
+	}
+out:
+	/* kthread_stop() wants us around until it is called */
+	set_current_state(TASK_INTERRUPTIBLE);
+	while (!kthread_should_stop()) {
+		schedule();
+		set_current_state(TASK_INTERRUPTIBLE);
+	}
+	__set_current_state(TASK_RUNNING);
+	return 0;
+}
+
+static long jit_skew_initiator(void *arg)
+{
+	struct jit_skew_probe *p = arg;
+	unsigned long seq, deadline;
+	u64 t0, t1, tb;
+
+	for (seq = 1; seq <= p->rounds; seq++) {
+		deadline = jiffies + JIT_SKEW_TIMEOUT;
+		t0 = p->clk->read();
+		smp_store_release(&p->ping, seq);
+		while (smp_load_acquire(&p->pong) != seq) {
+			if (time_after(jiffies, deadline)) {
+				smp_store_release(&p->aborted, 1);
+				return -ETIMEDOUT;
+			}
+			cpu_relax();
+		}
+		t1 = p->clk->read();
+		tb = p->pong_ts;
+
+		if (t1 - t0 < p->rtt) {
+			p->rtt	  = t1 - t0;
+			p->offset = (s64) (tb - t0) - (s64) (p->rtt / 2);
+		}
+	}
+	return 0;
+}
+
+static long jit_skew_pair(const struct jit_clock *clk, int a, int b)
+{
+	struct jit_skew_probe *p = &jit_skew;
+	struct task_struct *responder;
+	long ret;
+
+	memset(p, 0, sizeof(*p));
+	p->clk		= clk;
+	p->rounds	= skew_rounds;
+	p->rtt		= ~0ULL;
+
+	responder = kthread_create(jit_skew_responder, p, "jit_skew/%d", b);
+	if (IS_ERR(responder))
+		return PTR_ERR(responder);
+	kthread_bind(responder, b);
+	wake_up_process(responder);
+
+	ret = work_on_cpu(a, jit_skew_initiator, p);
+
+	kthread_stop(responder);
+	return ret;
+}
+
+static const struct jit_clock *jit_find_clock(const char *name)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(jit_clocks); i++)
+		if (sysfs_streq(jit_clocks[i].name, name))
+			return &jit_clocks[i];
+	return NULL;
 }
 
-/* Initialize a fops structure for the /proc file. Required by the seq_file
- * interface. We only are concerned about the open() method
+/*
+ * The clock probed, set through the skew_clock parameter: only the names
+ * in jit_clocks[] are taken, so there is always one to probe
  */
+static const struct jit_clock *jit_skew_clock;
+
+static int jit_skew_clock_set(const char *val, const struct kernel_param *kp)
+{
+	const struct jit_clock *clk = jit_find_clock(val);
+
+	if (!clk)
+		return -EINVAL;
+	WRITE_ONCE(jit_skew_clock, clk);
+	return 0;
+}
 
-static struct file_operations jit_proc_ops = {
-	.owner		= THIS_MODULE,
-	.open		= jit_proc_open,
-	.read		= seq_read,
-	.llseek		= seq_lseek,
-	.release	= seq_release
+static int jit_skew_clock_get(char *buf, const struct kernel_param *kp)
+{
+	return scnprintf(buf, PAGE_SIZE, "%s\n",
+			 READ_ONCE(jit_skew_clock)->name);
+}
+
+static const struct kernel_param_ops jit_skew_clock_ops = {
+	.set	= jit_skew_clock_set,
+	.get	= jit_skew_clock_get
 };
 
-static void jit_create_proc(void)
+module_param_cb(skew_clock, &jit_skew_clock_ops, NULL, 0644);
+
+/* The first line is a header, then one row per online CPU */
+static void *jit_skew_seq_start(struct seq_file *s, loff_t *pos)
 {
-	struct proc_dir_entry *entry;
-	entry = proc_create_data("cur_time", 0, NULL, &jit_proc_ops, NULL);
+	struct jit_skew_iter *iter = s->private;
+	int cpu;
+
+	if (*pos == 0)
+		return SEQ_START_TOKEN;
+	cpu = cpumask_next(*pos - 2, cpu_online_mask);
+	if (cpu >= nr_cpu_ids)
+		return NULL;
+	*pos = cpu + 1;
+	iter->cpu = cpu;
+	return iter;
 }
 
-static void jit_remove_proc(void)
+static void *jit_skew_seq_next(struct seq_file *s, void *v, loff_t *pos)
 {
-	remove_proc_entry("jitseq", NULL);
+	++(*pos);
+	return jit_skew_seq_start(s, pos);
 }
 
-int __init jit_init(void)
+static int jit_skew_seq_show(struct seq_file *s, void *v)
+{
+	struct jit_skew_iter *iter = s->private;
+	const struct jit_clock *clk;
+	int cpu;
+	long ret;
+
+	if (v == SEQ_START_TOKEN) {
+		/* the whole matrix is for one clock, whatever skew_clock says */
+		clk = iter->clk = READ_ONCE(jit_skew_clock);
+		seq_printf(s, "%s (%s): offset/round trip of column vs row\n",
+			   clk->name, clk->unit);
+		seq_printf(s, "%4s", "cpu");
+		for_each_online_cpu(cpu)
+			seq_printf(s, " %20d", cpu);
+		seq_putc(s, '\n');
+		return 0;
+	}
+
+	clk = iter->clk;
+	seq_printf(s, "%4d", iter->cpu);
+	for_each_online_cpu(cpu) {
+		if (cpu == iter->cpu) {
+			seq_printf(s, " %20s", "-");
+			continue;
+		}
+		if (signal_pending(current))
+			return -ERESTARTSYS;
+
+		mutex_lock(&jit_bench_mutex);
+		ret = jit_skew_pair(clk, iter->cpu, cpu);
+		if (ret == -ETIMEDOUT)
+			seq_printf(s, " %20s", "timeout");
+		else if (ret)
+			seq_printf(s, " %14s%6ld", "error ", ret);
+		else
+			seq_printf(s, " %12lld/%-7llu", jit_skew.offset,
+				   jit_skew.rtt);
+		mutex_unlock(&jit_bench_mutex);
+	}
+	seq_putc(s, '\n');
+	return 0;
+}
+
+static struct seq_operations jit_skew_seq_ops = {
+	.start	= jit_skew_seq_start,
+	.next	= jit_skew_seq_next,
+	.stop	= jit_seq_stop,
+	.show	= jit_skew_seq_show
+};
+
+static int jit_skew_proc_open(struct inode *inode, struct file *file)
 {
-	jit_create_proc();
+	return seq_open_private(file, &jit_skew_seq_ops,
+				sizeof(struct jit_skew_iter));
+}
+
+static const struct dd_proc_ops jit_skew_proc_ops = {
+	DD_PROC_OPS(jit_skew_proc_open, seq_read, NULL, seq_lseek,
+		    seq_release_private)
+};
 
-	return 0; /* success */
+static const struct dd_proc jit_procs[] = {
+	{ "cur_time",		0644,	&jit_stream_proc_ops,	&jit_src },
+	{ "cur_time_bench",	0400,	&jit_bench_proc_ops,	NULL },
+	{ "cur_time_skew",	0400,	&jit_skew_proc_ops,	NULL },
+};
+
+int __init jit_init(void)
+{
+	if (!jit_skew_clock)
+		jit_skew_clock = jit_find_clock("local_clock");
+	return DD_PROC_REGISTER(jit_procs);
 }
 
 void __exit jit_cleanup(void)
 {
-	jit_remove_proc();
+	DD_PROC_UNREGISTER(jit_procs);
 }
 
 module_init(jit_init);
@@ -0,0 +1,433 @@
+/*
+ * jit_load.c -- background load to run the jit delay modules against
+ *
+ * Starts `threads` kthreads on every online CPU, each generating one kind
+ * of contention:
+ * - spin:	burn the CPU, with a preemption point now and then
+ * - memwalk:	write one byte per cache line over a `walk_kb` buffer, to
+ *		thrash the caches
+ * - softirq:	a tasklet that keeps rescheduling itself
+ * - timer:	a pinned hrtimer firing every `timer_us` microseconds
+ *
+ * The profile is picked at load time, or later by writing to /proc/jit_load:
+ *	echo "memwalk 2" > /proc/jit_load	# two walkers per CPU
+ *	echo none > /proc/jit_load		# back to idle
+ * All the parameters are writable in /sys/module/jit_load/parameters too;
+ * changing any of them restarts the load with the new settings.
+ * Reading /proc/jit_load shows the work done per CPU. The profile is also
+ * handed to jit_stream, which tags every sample of the delay modules.
+ */
+
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/init.h>
+
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/proc_fs.h>
+#include <linux/seq_file.h>
+#include <linux/kthread.h>
+#include <linux/mutex.h>
+#include <linux/cpumask.h>
+#include <linux/cpu.h>		/* cpus_read_lock() */
+#include <linux/topology.h>	/* cpu_to_node() */
+#include <linux/cache.h>
+#include <linux/sched.h>
+#include <linux/uaccess.h>
+
+#include "dd_compat.h"
+#include "dd_core.h"
+#include "dd_param.h"
+#include "jit_stream.h"
+
+static int threads	= 1;		/* kthreads per online CPU */
+static int walk_kb	= 32768;	/* memwalk buffer per thread */
+static int timer_us	= 10;		/* timer storm period */
+
+static int jit_load_apply(void);
+
+DD_PARAM(threads, int, 1, 64, jit_load_apply);
+DD_PARAM(walk_kb, int, 4, 1 << 20, jit_load_apply);
+DD_PARAM(timer_us, int, 1, USEC_PER_SEC, jit_load_apply);
+
+MODULE_AUTHOR("Salym Senyonga");
+MODULE_LICENSE("GPL");
+
+enum jit_load_kind {
+	JIT_LOAD_NONE,
+	JIT_LOAD_SPIN,
+	JIT_LOAD_MEMWALK,
+	JIT_LOAD_SOFTIRQ,
+	JIT_LOAD_TIMER
+};
+
+static const char * const jit_load_names[] = {
+	[JIT_LOAD_NONE]		= "none",
+	[JIT_LOAD_SPIN]		= "spin",
+	[JIT_LOAD_MEMWALK]	= "memwalk",
+	[JIT_LOAD_SOFTIRQ]	= "softirq",
+	[JIT_LOAD_TIMER]	= "timer"
+};
+
+struct jit_load_worker {
+	struct task_struct *task;
+	int cpu;
+	unsigned long iterations;	/* units of work done so far */
+
+	char *walk;			/* memwalk */
+	size_t walk_size;		/* walk_kb when it was allocated */
+	struct tasklet_struct tlet;	/* softirq */
+	struct hrtimer timer;		/* timer */
+};
+
+/* The running load; only changed under jit_load_mutex */
+static DEFINE_MUTEX(jit_load_mutex);
+static enum jit_load_kind jit_load_kind;
+static int jit_load_threads;
+static struct jit_load_worker *jit_load_workers;
+static int jit_load_nr_workers;
+static bool jit_load_stopping;	/* softirq and timer work must not rearm */
+
+/* What the parameters ask for; applied once jit_load_ready */
+static enum jit_load_kind jit_load_profile;
+static bool jit_load_ready;
+
+/*
+ * The kinds of load
+ */
+static void jit_load_spin(struct jit_load_worker *w)
+{
+	int i;
+
+	while (!kthread_should_stop()) {
+		for (i = 0; i < 1024; i++)
+			cpu_relax();
+		w->iterations++;
+		cond_resched();
+	}
+}
+
+static void jit_load_memwalk(struct jit_load_worker *w)
+{
+	size_t off;
+
+	while (!kthread_should_stop()) {
+		for (off = 0; off < w->walk_size; off += L1_CACHE_BYTES) {
+			w->walk[off]++;
+			if (!(off & ((1 << 20) - 1)))
+				cond_resched();
+		}
+		w->iterations++;
+	}
+}
+
+static void jit_load_tasklet_fn(struct tasklet_struct *t)
+{
+	struct jit_load_worker *w = from_tasklet(w, t, tlet);
+
+	w->iterations++;
+	if (!READ_ONCE(jit_load_stopping))
+		tasklet_schedule(&w->tlet);
+}
+
+static enum hrtimer_restart jit_load_timer_fn(struct hrtimer *t)
+{
+	struct jit_load_worker *w = container_of(t, struct jit_load_worker,
+						 timer);
+
+	w->iterations++;
+	if (READ_ONCE(jit_load_stopping))
+		return HRTIMER_NORESTART;
+	hrtimer_forward_now(t, ns_to_ktime((u64) timer_us * NSEC_PER_USEC));
+	return HRTIMER_RESTART;
+}
+
+/* Sleep until jit_load_stop() calls kthread_stop() */
+static void jit_load_idle(void)
+{
+	set_current_state(TASK_INTERRUPTIBLE);
+	while (!kthread_should_stop()) {
+		schedule();
+		set_current_state(TASK_INTERRUPTIBLE);
+	}
+	__set_current_state(TASK_RUNNING);
+}
+
+static int jit_load_thread(void *arg)
+{
+	struct jit_load_worker *w = arg;
+
+	switch (jit_load_kind) {
+	case JIT_LOAD_SPIN:
+		jit_load_spin(w);
+		break;
+	case JIT_LOAD_MEMWALK:
+		jit_load_memwalk(w);
+		break;
+	case JIT_LOAD_SOFTIRQ:
+		/* we are bound to w->cpu, so the tasklet runs there too */
+		tasklet_setup(&w->tlet, jit_load_tasklet_fn);
+		tasklet_schedule(&w->tlet);
+		jit_load_idle();
+		tasklet_kill(&w->tlet);
+		break;
+	case JIT_LOAD_TIMER:
+		hrtimer_setup(&w->timer, jit_load_timer_fn, CLOCK_MONOTONIC,
+			      HRTIMER_MODE_REL_PINNED);
+		hrtimer_start(&w->timer,
+			      ns_to_ktime((u64) timer_us * NSEC_PER_USEC),
+			      HRTIMER_MODE_REL_PINNED);
+		jit_load_idle();
+		hrtimer_cancel(&w->timer);
+		break;
+	default:
+		jit_load_idle();
+	}
+	return 0;
+}
+
+/*
+ * Starting and stopping; called with jit_load_mutex held
+ */
+static void jit_load_stop(void)
+{
+	int i;
+
+	jit_load_stopping = true;
+	for (i = 0; i < jit_load_nr_workers; i++) {
+		if (!IS_ERR_OR_NULL(jit_load_workers[i].task))
+			kthread_stop(jit_load_workers[i].task);
+		vfree(jit_load_workers[i].walk);
+	}
+	kfree(jit_load_workers);
+	jit_load_workers	= NULL;
+	jit_load_nr_workers	= 0;
+	jit_load_kind		= JIT_LOAD_NONE;
+	jit_load_threads	= 0;
+	jit_set_load_tag(jit_load_names[JIT_LOAD_NONE]);
+}
+
+static int jit_load_start(enum jit_load_kind kind, int per_cpu)
+{
+	struct jit_load_worker *w;
+	size_t walk_size = (size_t) READ_ONCE(walk_kb) * 1024;
+	char tag[JIT_TAG_MAX];
+	int cpu, i, n = 0, nr, ret;
+
+	jit_load_stop();
+	if (kind == JIT_LOAD_NONE)
+		return 0;
+	if (per_cpu <= 0)
+		return -EINVAL;
+
+	/* the online CPUs, which needn't be numbered 0..n-1, stay put */
+	cpus_read_lock();
+	nr = num_online_cpus() * per_cpu;
+	jit_load_workers = kcalloc(nr, sizeof(*jit_load_workers), GFP_KERNEL);
+	if (!jit_load_workers) {
+		cpus_read_unlock();
+		return -ENOMEM;
+	}
+	jit_load_kind		= kind;
+	jit_load_threads	= per_cpu;
+	jit_load_stopping	= false;
+
+	/* create everything first, so a failure leaves no load running */
+	for_each_online_cpu(cpu) {
+		for (i = 0; i < per_cpu && n < nr; i++) {
+			w = &jit_load_workers[n++];
+			jit_load_nr_workers = n;
+			w->cpu = cpu;
+
+			if (kind == JIT_LOAD_MEMWALK) {
+				w->walk = vzalloc_node(walk_size,
+						       cpu_to_node(cpu));
+				if (!w->walk) {
+					ret = -ENOMEM;
+					goto fail;
+				}
+				w->walk_size = walk_size;
+			}
+			w->task = kthread_create_on_node(jit_load_thread, w,
+					cpu_to_node(cpu), "jit_load/%d:%d",
+					cpu, i);
+			if (IS_ERR(w->task)) {
+				ret = PTR_ERR(w->task);
+				goto fail;
+			}
+			kthread_bind(w->task, cpu);
+		}
+	}
+	cpus_read_unlock();
+	for (i = 0; i < jit_load_nr_workers; i++)
+		wake_up_process(jit_load_workers[i].task);
+
+	snprintf(tag, sizeof(tag), "%s:%d", jit_load_names[kind], per_cpu);
+	jit_set_load_tag(tag);
+	return 0;
+
+fail:
+	cpus_read_unlock();
+	jit_load_stop();
+	return ret;
+}
+
+static int jit_load_lookup(const char *name)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(jit_load_names); i++)
+		if (sysfs_streq(jit_load_names[i], name))
+			return i;
+	return -EINVAL;
+}
+
+/*
+ * /proc fs stuff : using seq_file
+ */
+static int jit_load_show(struct seq_file *s, void *v)
+{
+	unsigned long total;
+	int cpu, i;
+
+	mutex_lock(&jit_load_mutex);
+	seq_printf(s, "profile %s threads %d\n", jit_load_names[jit_load_kind],
+		   jit_load_threads);
+	for_each_online_cpu(cpu) {
+		total = 0;
+		for (i = 0; i < jit_load_nr_workers; i++)
+			if (jit_load_workers[i].cpu == cpu)
+				total += jit_load_workers[i].iterations;
+		seq_printf(s, "%4d %12lu\n", cpu, total);
+	}
+	mutex_unlock(&jit_load_mutex);
+	return 0;
+}
+
+static int jit_load_proc_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, jit_load_show, NULL);
+}
+
+/* Accepts "<profile> [threads per cpu]" */
+static ssize_t jit_load_proc_write(struct file *file, const char __user *buf,
+				   size_t count, loff_t *pos)
+{
+	char kbuf[32], name[16];
+	int kind, per_cpu = threads;
+	int ret;
+
+	if (count >= sizeof(kbuf))
+		return -EINVAL;
+	if (copy_from_user(kbuf, buf, count))
+		return -EFAULT;
+	kbuf[count] = '\0';
+
+	if (sscanf(kbuf, "%15s %d", name, &per_cpu) < 1)
+		return -EINVAL;
+	kind = jit_load_lookup(name);
+	if (kind < 0)
+		return kind;
+
+	if (per_cpu < 1 || per_cpu > 64)
+		return -EINVAL;
+
+	mutex_lock(&jit_load_mutex);
+	ret = jit_load_start(kind, per_cpu);
+	if (!ret) {
+		jit_load_profile = kind;
+		WRITE_ONCE(threads, per_cpu);
+	}
+	mutex_unlock(&jit_load_mutex);
+
+	return ret ? ret : count;
+}
+
+static const struct dd_proc_ops jit_load_proc_ops = {
+	DD_PROC_OPS(jit_load_proc_open, seq_read, jit_load_proc_write,
+		    seq_lseek, single_release)
+};
+
+static const struct dd_proc jit_load_procs[] = {
+	{ "jit_load", 0644, &jit_load_proc_ops, NULL },
+};
+
+/*
+ * Parameters: restart the load whenever one of them changes
+ */
+static int jit_load_apply(void)
+{
+	int ret = 0;
+
+	mutex_lock(&jit_load_mutex);
+	if (jit_load_ready)
+		ret = jit_load_start(jit_load_profile, threads);
+	mutex_unlock(&jit_load_mutex);
+	return ret;
+}
+
+static int jit_load_profile_set(const char *val, const struct kernel_param *kp)
+{
+	int kind, ret = 0;
+
+	kind = jit_load_lookup(val);
+	if (kind < 0)
+		return kind;
+
+	mutex_lock(&jit_load_mutex);
+	if (jit_load_ready)
+		ret = jit_load_start(kind, threads);
+	if (!ret)
+		jit_load_profile = kind;
+	mutex_unlock(&jit_load_mutex);
+	return ret;
+}
+
+static int jit_load_profile_get(char *buf, const struct kernel_param *kp)
+{
+	return scnprintf(buf, PAGE_SIZE, "%s\n",
+			 jit_load_names[jit_load_profile]);
+}
+
+static const struct kernel_param_ops jit_load_profile_ops = {
+	.set	= jit_load_profile_set,
+	.get	= jit_load_profile_get
+};
+
+/* the load to start with: none, spin, memwalk, softirq or timer */
+module_param_cb(profile, &jit_load_profile_ops, NULL, 0644);
+
+static int __init jit_load_init(void)
+{
+	int ret;
+
+	mutex_lock(&jit_load_mutex);
+	ret = jit_load_start(jit_load_profile, threads);
+	jit_load_ready = !ret;
+	mutex_unlock(&jit_load_mutex);
+	if (ret)
+		return ret;
+
+	ret = DD_PROC_REGISTER(jit_load_procs);
+	if (ret) {
+		mutex_lock(&jit_load_mutex);
+		jit_load_ready = false;
+		jit_load_stop();
+		mutex_unlock(&jit_load_mutex);
+	}
+	return ret;
+}
+
+static void __exit jit_load_exit(void)
+{
+	DD_PROC_UNREGISTER(jit_load_procs);
+
+	mutex_lock(&jit_load_mutex);
+	jit_load_ready = false;
+	jit_load_stop();
+	mutex_unlock(&jit_load_mutex);
+}
+
+module_init(jit_load_init);
+module_exit(jit_load_exit);
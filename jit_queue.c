@@ -4,7 +4,8 @@
  *		sleeps forever. A sort of "bounded sleep"
  *
  * This particular module, however, has no event to wait for and uses
- * 0 as a condition.
+ * 0 as a condition. Lines are sampled by a kthread and streamed to the
+ * reader, see jit_stream.h.
  */
 
 #include <linux/module.h>
@@ -21,10 +22,17 @@
 #include <linux/sched.h>	/* schedule() */
 #include <asm/hardirq.h>
 
-int jq_nr_lines	= 5;	/* Temporary fix; determines no. of lines return by `cat` */
+#include "dd_compat.h"
+#include "dd_core.h"
+#include "dd_param.h"
+#include "jit_stream.h"
+
+/* lines per open; 0 streams until the reader closes */
+static unsigned int nr_lines = 5;
 int delay	= HZ;	/* the default delay, expressed in jiffies */
 
-module_param(delay, int, 0);
+DD_PARAM(delay, int, 0, 60 * HZ, NULL);
+DD_PARAM(nr_lines, uint, 0, UINT_MAX, NULL);
 
 MODULE_AUTHOR("Salym Senyonga");
 MODULE_LICENSE("GPL");
@@ -33,90 +41,53 @@ MODULE_LICENSE("GPL");
  * /proc fs stuff : using seq_file
  */
 
-/* The sequence iteration methods */
-static void *jit_seq_start(struct seq_file *s, loff_t *pos)
-{
-	if (*pos >= jq_nr_lines)
-		return NULL;
-	return jq_nr_lines + *pos;
-}
-
-static void *jit_seq_next(struct seq_file *s, void *v, loff_t *pos)
-{
-	if (++(*pos) >= jq_nr_lines)
-		return NULL;
-	return jq_nr_lines + *pos;
-}
-
-static void jit_seq_stop(struct seq_file *s, void *v)
-{
-}
-
-static int jit_seq_show(struct seq_file *s, void *v)
+/*
+ * Takes one sample: delay, then report jiffies before and after, followed
+ * by the CPU time (in us), context switches and wakeups the delay cost
+ * and the background load it ran under
+ */
+static int jit_queue_sample(char *buf, size_t len, void *data)
 {
 	unsigned long j0, j1;	/* jiffies */
+	struct jit_cost cost;
+	int n;
 	wait_queue_head_t wait;
 
 	init_waitqueue_head(&wait);
 
+	jit_cost_start(&cost);
 	j0 = jiffies;
 	j1 = j0 + delay;
 
 	wait_event_interruptible_timeout(wait, 0, delay);
 
 	j1 = jiffies;	/* value after we delayed */
-	seq_printf(s, "%9li %9li\n", j0, j1);
+	jit_cost_end(&cost);
 
-	return 0;
+	n  = scnprintf(buf, len, "%9li %9li", j0, j1);
+	n += jit_cost_print(buf + n, len - n, &cost);
+	n += jit_load_print(buf + n, len - n);
+	n += scnprintf(buf + n, len - n, "\n");
+	return n;
 }
 
-/* build up the seq_ops structure */
-static struct seq_operations jit_seq_ops = {
-	.start	= jit_seq_start,
-	.next	= jit_seq_next,
-	.stop	= jit_seq_stop,
-	.show	= jit_seq_show
+/* What the /proc file streams, see jit_stream.h */
+static struct jit_source jit_src = {
+	"jit_queue", jit_queue_sample, NULL, &nr_lines
 };
 
-/* the open() method that connects the /proc file the the seq_ops */
-static int jit_proc_open(struct inode *inode, struct file *file)
-{
-	return seq_open(file, &jit_seq_ops);
-}
-
-/* Initialize a fops structure for the /proc file. Required by the seq_file
- * interface. We only are concerned about the open() method
- */
-
-static struct file_operations jit_proc_ops = {
-	.owner		= THIS_MODULE,
-	.open		= jit_proc_open,
-	.read		= seq_read,
-	.llseek		= seq_lseek,
-	.release	= seq_release
+static const struct dd_proc jit_procs[] = {
+	{ "jit_queue", 0644, &jit_stream_proc_ops, &jit_src },
 };
 
-static void jit_create_proc(void)
-{
-	struct proc_dir_entry *entry;
-	entry = proc_create_data("jit_queue", 0, NULL, &jit_proc_ops, NULL);
-}
-
-static void jit_remove_proc(void)
-{
-	remove_proc_entry("jit_queue", NULL);
-}
-
 int __init jit_init(void)
 {
-	jit_create_proc();
-
-	return 0; /* success */
+	return DD_PROC_REGISTER(jit_procs);
 }
 
 void __exit jit_cleanup(void)
 {
-	jit_remove_proc();
+	DD_PROC_UNREGISTER(jit_procs);
 }
 
 module_init(jit_init);
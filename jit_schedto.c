@@ -0,0 +1,92 @@
+/*
+ * jit_schedto.c -- delaying execution with a timeout
+ *
+ * Unlike jit_sched, which keeps calling schedule() until enough jiffies
+ * have passed, this one sleeps once with schedule_timeout() and lets the
+ * timer wake it up. Lines are sampled by a kthread and streamed to the
+ * reader, see jit_stream.h.
+ */
+
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/init.h>
+
+#include <linux/time.h>
+#include <linux/timer.h>
+#include <linux/kernel.h>
+#include <linux/proc_fs.h>
+#include <linux/seq_file.h>	/* we're using the seq_file interface */
+#include <linux/types.h>
+#include <linux/spinlock.h>
+#include <linux/interrupt.h>
+#include <linux/sched.h>	/* schedule() */
+
+#include <asm/hardirq.h>
+
+#include "dd_compat.h"
+#include "dd_core.h"
+#include "dd_param.h"
+#include "jit_stream.h"
+
+/* lines per open; 0 streams until the reader closes */
+static unsigned int nr_lines = 5;
+int delay		= HZ;	/* the default delay, expressed in jiffies */
+
+DD_PARAM(delay, int, 0, 60 * HZ, NULL);
+DD_PARAM(nr_lines, uint, 0, UINT_MAX, NULL);
+
+MODULE_AUTHOR("Salym Senyonga");
+MODULE_LICENSE("GPL");
+
+/*
+ * /proc fs stuff : using seq_file
+ */
+
+/*
+ * Takes one sample: delay, then report jiffies before and after, followed
+ * by the CPU time (in us), context switches and wakeups the delay cost
+ * and the background load it ran under
+ */
+static int jit_schedto_sample(char *buf, size_t len, void *data)
+{
+	unsigned long j0, j1;	/* jiffies */
+	struct jit_cost cost;
+	int n;
+
+	jit_cost_start(&cost);
+	j0 = jiffies;
+	j1 = j0 + delay;
+
+	set_current_state(TASK_INTERRUPTIBLE);
+	schedule_timeout(delay);
+	j1 = jiffies;	/* value after we delayed */
+	jit_cost_end(&cost);
+
+	n  = scnprintf(buf, len, "%9li %9li", j0, j1);
+	n += jit_cost_print(buf + n, len - n, &cost);
+	n += jit_load_print(buf + n, len - n);
+	n += scnprintf(buf + n, len - n, "\n");
+	return n;
+}
+
+/* What the /proc file streams, see jit_stream.h */
+static struct jit_source jit_src = {
+	"jit_schedto", jit_schedto_sample, NULL, &nr_lines
+};
+
+static const struct dd_proc jit_procs[] = {
+	{ "jit_schedto", 0644, &jit_stream_proc_ops, &jit_src },
+};
+
+int __init jit_init(void)
+{
+	return DD_PROC_REGISTER(jit_procs);
+}
+
+void __exit jit_cleanup(void)
+{
+	DD_PROC_UNREGISTER(jit_procs);
+}
+
+module_init(jit_init);
+module_exit(jit_cleanup);
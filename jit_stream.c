@@ -0,0 +1,342 @@
+/*
+ * jit_stream.c -- asynchronous sample streaming for the jit /proc files
+ *
+ * The seq iterator carries a pointer to the per-open stream rather than a
+ * line number: start() blocks until the producer has a line ready, show()
+ * peeks at it and next() consumes it. If next() finds the fifo empty it
+ * ends the read, handing whatever is buffered to user space.
+ */
+
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/init.h>
+
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/fs.h>
+#include <linux/seq_file.h>
+#include <linux/proc_fs.h>
+#include <linux/kfifo.h>
+#include <linux/kthread.h>
+#include <linux/mutex.h>
+#include <linux/wait.h>
+#include <linux/sched.h>
+#include <linux/uaccess.h>
+#include <linux/spinlock.h>
+#include <linux/math64.h>	/* div_u64() */
+
+#include "dd_compat.h"
+#include "dd_param.h"
+#include "jit_stream.h"
+
+static unsigned int fifo_size = PAGE_SIZE;	/* bytes buffered per open */
+
+DD_PARAM(fifo_size, uint, 2 * JIT_LINE_MAX, 1 << 24, NULL);
+
+MODULE_AUTHOR("Salym Senyonga");
+MODULE_LICENSE("GPL");
+
+struct jit_stream {
+	const char *name;
+	jit_sample_fn sample;
+	void *data;
+	unsigned int limit;		/* lines to produce; 0 means no limit */
+
+	struct mutex lock;		/* protects producer and limit */
+	struct task_struct *producer;
+	bool done;			/* the producer wrote its last line */
+
+	struct kfifo_rec_ptr_1 fifo;	/* one record per line */
+	wait_queue_head_t data_wait;	/* the reader waits for lines */
+	wait_queue_head_t space_wait;	/* the producer waits for room */
+};
+
+static int jit_stream_producer(void *arg)
+{
+	struct jit_stream *st = arg;
+	char line[JIT_LINE_MAX];
+	unsigned int n;
+	int len;
+
+	for (n = 0; !st->limit || n < st->limit; n++) {
+		wait_event_interruptible(st->space_wait,
+				kfifo_avail(&st->fifo) >= JIT_LINE_MAX ||
+				kthread_should_stop());
+		if (kthread_should_stop())
+			break;
+
+		len = st->sample(line, sizeof(line), st->data);
+		if (len < 0)
+			break;
+		if (!len)
+			continue;
+		kfifo_in(&st->fifo, line, len);
+		wake_up_interruptible(&st->data_wait);
+	}
+	st->done = true;
+	wake_up_interruptible(&st->data_wait);
+
+	/* kthread_stop() wants us around until it is called */
+	set_current_state(TASK_INTERRUPTIBLE);
+	while (!kthread_should_stop()) {
+		schedule();
+		set_current_state(TASK_INTERRUPTIBLE);
+	}
+	__set_current_state(TASK_RUNNING);
+	return 0;
+}
+
+/* Start the producer on the first read, once the line count is settled */
+static int jit_stream_run(struct jit_stream *st)
+{
+	struct task_struct *t;
+	int ret = 0;
+
+	mutex_lock(&st->lock);
+	if (!st->producer) {
+		t = kthread_run(jit_stream_producer, st, "%s", st->name);
+		if (IS_ERR(t))
+			ret = PTR_ERR(t);
+		else
+			st->producer = t;
+	}
+	mutex_unlock(&st->lock);
+	return ret;
+}
+
+/*
+ * The sequence iteration methods
+ */
+static void *jit_stream_seq_start(struct seq_file *s, loff_t *pos)
+{
+	struct jit_stream *st = s->private;
+	int ret;
+
+	ret = jit_stream_run(st);
+	if (ret)
+		return ERR_PTR(ret);
+
+	if (wait_event_interruptible(st->data_wait,
+				     !kfifo_is_empty(&st->fifo) || st->done))
+		return ERR_PTR(-ERESTARTSYS);
+	if (kfifo_is_empty(&st->fifo))
+		return NULL;	/* the producer is done and we've read it all */
+	return st;
+}
+
+static void *jit_stream_seq_next(struct seq_file *s, void *v, loff_t *pos)
+{
+	struct jit_stream *st = v;
+
+	/* the line shown last made it into the seq buffer; drop it */
+	kfifo_skip(&st->fifo);
+	wake_up_interruptible(&st->space_wait);
+	++(*pos);
+
+	/* rather than block with a part-filled page, let the reader have it */
+	if (kfifo_is_empty(&st->fifo))
+		return NULL;
+	return st;
+}
+
+static void jit_stream_seq_stop(struct seq_file *s, void *v)
+{
+}
+
+static int jit_stream_seq_show(struct seq_file *s, void *v)
+{
+	struct jit_stream *st = v;
+	char line[JIT_LINE_MAX];
+	unsigned int len;
+
+	/* only peek: if the line overflows the buffer it is shown again */
+	len = kfifo_out_peek(&st->fifo, line, sizeof(line));
+	seq_write(s, line, len);
+	return 0;
+}
+
+static struct seq_operations jit_stream_seq_ops = {
+	.start	= jit_stream_seq_start,
+	.next	= jit_stream_seq_next,
+	.stop	= jit_stream_seq_stop,
+	.show	= jit_stream_seq_show
+};
+
+/*
+ * The file operations used by the jit modules
+ */
+int jit_stream_open(struct file *file, const char *name, jit_sample_fn sample,
+		    void *data, unsigned int nr_lines)
+{
+	struct jit_stream *st;
+	int ret;
+
+	st = kzalloc(sizeof(*st), GFP_KERNEL);
+	if (!st)
+		return -ENOMEM;
+
+	ret = kfifo_alloc(&st->fifo, READ_ONCE(fifo_size), GFP_KERNEL);
+	if (ret)
+		goto fail_fifo;
+
+	st->name	= name;
+	st->sample	= sample;
+	st->data	= data;
+	st->limit	= nr_lines;
+	mutex_init(&st->lock);
+	init_waitqueue_head(&st->data_wait);
+	init_waitqueue_head(&st->space_wait);
+
+	ret = seq_open(file, &jit_stream_seq_ops);
+	if (ret)
+		goto fail_seq;
+	((struct seq_file *) file->private_data)->private = st;
+	return 0;
+
+fail_seq:
+	kfifo_free(&st->fifo);
+fail_fifo:
+	kfree(st);
+	return ret;
+}
+EXPORT_SYMBOL_GPL(jit_stream_open);
+
+/* Writing a number sets the line count for this open (0: stream forever) */
+ssize_t jit_stream_write(struct file *file, const char __user *buf,
+			 size_t count, loff_t *pos)
+{
+	struct jit_stream *st = ((struct seq_file *) file->private_data)->private;
+	unsigned int limit;
+	int ret;
+
+	ret = kstrtouint_from_user(buf, count, 0, &limit);
+	if (ret)
+		return ret;
+
+	mutex_lock(&st->lock);
+	if (st->producer)
+		ret = -EBUSY;	/* too late, sampling has started */
+	else
+		st->limit = limit;
+	mutex_unlock(&st->lock);
+
+	return ret ? ret : count;
+}
+EXPORT_SYMBOL_GPL(jit_stream_write);
+
+int jit_stream_release(struct inode *inode, struct file *file)
+{
+	struct jit_stream *st = ((struct seq_file *) file->private_data)->private;
+
+	if (st->producer)
+		kthread_stop(st->producer);
+	kfifo_free(&st->fifo);
+	kfree(st);
+
+	return seq_release(inode, file);
+}
+EXPORT_SYMBOL_GPL(jit_stream_release);
+
+/* The open() method of jit_stream_proc_ops: the entry's data says what */
+static int jit_stream_proc_open(struct inode *inode, struct file *file)
+{
+	const struct jit_source *src = pde_data(inode);
+
+	return jit_stream_open(file, src->name, src->sample, src->data,
+			       READ_ONCE(*src->nr_lines));
+}
+
+const struct dd_proc_ops jit_stream_proc_ops = {
+	DD_PROC_OPS(jit_stream_proc_open, seq_read, jit_stream_write,
+		    noop_llseek, jit_stream_release)
+};
+EXPORT_SYMBOL_GPL(jit_stream_proc_ops);
+
+/*
+ * Cost accounting, for the task taking the samples
+ *
+ * sum_exec_runtime is brought up to date at every tick and context switch,
+ * so a sample that never sleeps is accurate to a tick.
+ */
+static void jit_cost_snapshot(struct jit_cost *c)
+{
+	struct task_struct *t = current;
+
+	c->runtime_ns	= t->se.sum_exec_runtime;
+	c->nvcsw	= t->nvcsw;
+	c->nivcsw	= t->nivcsw;
+#ifdef CONFIG_SCHEDSTATS
+	c->wakeups	= dd_task_schedstats(t)->nr_wakeups;
+#else
+	c->wakeups	= 0;
+#endif
+}
+
+void jit_cost_start(struct jit_cost *c)
+{
+	jit_cost_snapshot(c);
+}
+EXPORT_SYMBOL_GPL(jit_cost_start);
+
+void jit_cost_end(struct jit_cost *c)
+{
+	struct jit_cost now;
+
+	jit_cost_snapshot(&now);
+	c->runtime_ns	= now.runtime_ns - c->runtime_ns;
+	c->nvcsw	= now.nvcsw - c->nvcsw;
+	c->nivcsw	= now.nivcsw - c->nivcsw;
+	c->wakeups	= now.wakeups - c->wakeups;
+}
+EXPORT_SYMBOL_GPL(jit_cost_end);
+
+int jit_cost_print(char *buf, size_t len, const struct jit_cost *c)
+{
+#ifdef CONFIG_SCHEDSTATS
+	return scnprintf(buf, len, " %9llu %5lu %5lu %5lu",
+			 div_u64(c->runtime_ns, NSEC_PER_USEC),
+			 c->nvcsw, c->nivcsw, c->wakeups);
+#else
+	return scnprintf(buf, len, " %9llu %5lu %5lu %5s",
+			 div_u64(c->runtime_ns, NSEC_PER_USEC),
+			 c->nvcsw, c->nivcsw, "-");
+#endif
+}
+EXPORT_SYMBOL_GPL(jit_cost_print);
+
+/*
+ * Load profile tagging
+ */
+static DEFINE_SPINLOCK(jit_tag_lock);
+static char jit_tag[JIT_TAG_MAX] = "none";
+
+void jit_set_load_tag(const char *tag)
+{
+	spin_lock(&jit_tag_lock);
+	snprintf(jit_tag, sizeof(jit_tag), "%s", tag);
+	spin_unlock(&jit_tag_lock);
+}
+EXPORT_SYMBOL_GPL(jit_set_load_tag);
+
+int jit_load_print(char *buf, size_t len)
+{
+	int n;
+
+	spin_lock(&jit_tag_lock);
+	n = scnprintf(buf, len, " %s", jit_tag);
+	spin_unlock(&jit_tag_lock);
+	return n;
+}
+EXPORT_SYMBOL_GPL(jit_load_print);
+
+static int __init jit_stream_init(void)
+{
+	return 0;
+}
+
+static void __exit jit_stream_exit(void)
+{
+}
+
+module_init(jit_stream_init);
+module_exit(jit_stream_exit);
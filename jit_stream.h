@@ -0,0 +1,86 @@
+/*
+ * jit_stream.h -- streaming /proc files for the jit modules
+ *
+ * Each open of a jit /proc file gets its own producer kthread, which takes
+ * samples into a record fifo while the reader drains it through seq_file.
+ * A read returns as soon as at least one line is available, so the output
+ * streams instead of arriving a page at a time.
+ *
+ * The number of lines produced per open starts at the module's `nr_lines`
+ * (0 streams until the reader closes the file) and may be changed by
+ * writing a count to the open file before the first read:
+ *
+ *	exec 3<>/proc/jit_busy; echo 0 >&3; cat <&3
+ */
+
+#ifndef _JIT_STREAM_H
+#define _JIT_STREAM_H
+
+#include <linux/fs.h>
+#include <linux/types.h>
+
+#include "dd_compat.h"
+
+#define JIT_LINE_MAX	160	/* the longest record a sample may produce */
+
+/*
+ * Takes one sample and formats it into buf; returns the length written, or
+ * a negative error, which ends the stream, if there is no sample to give
+ */
+typedef int (*jit_sample_fn)(char *buf, size_t len, void *data);
+
+int jit_stream_open(struct file *file, const char *name, jit_sample_fn sample,
+		    void *data, unsigned int nr_lines);
+ssize_t jit_stream_write(struct file *file, const char __user *buf,
+			 size_t count, loff_t *pos);
+int jit_stream_release(struct inode *inode, struct file *file);
+
+/*
+ * Most jit /proc files need nothing more: give jit_stream_proc_ops as the
+ * entry's ops and a jit_source as its data
+ *
+ *	static struct jit_source jit_busy_src = {
+ *		"jit_busy", jit_busy_sample, NULL, &nr_lines
+ *	};
+ *	static const struct dd_proc jit_procs[] = {
+ *		{ "jit_busy", 0644, &jit_stream_proc_ops, &jit_busy_src },
+ *	};
+ */
+struct jit_source {
+	const char *name;
+	jit_sample_fn sample;
+	void *data;			/* for sample() */
+	unsigned int *nr_lines;		/* the module's parameter */
+};
+
+extern const struct dd_proc_ops jit_stream_proc_ops;
+
+/*
+ * What taking a sample cost the producer: CPU time, voluntary and
+ * involuntary context switches and wakeups. Take a snapshot before the
+ * delay with jit_cost_start() and turn it into deltas with jit_cost_end().
+ */
+struct jit_cost {
+	u64 runtime_ns;
+	unsigned long nvcsw;
+	unsigned long nivcsw;
+	unsigned long wakeups;	/* only counted with CONFIG_SCHEDSTATS */
+};
+
+void jit_cost_start(struct jit_cost *c);
+void jit_cost_end(struct jit_cost *c);
+
+/* Appends " cpu_us nvcsw nivcsw wakeups" to a sample line */
+int jit_cost_print(char *buf, size_t len, const struct jit_cost *c);
+
+/*
+ * The background load running while samples are taken, as set by jit_load.
+ * jit_load_print() appends it to a sample line, so results can be told
+ * apart by load profile.
+ */
+#define JIT_TAG_MAX	24
+
+void jit_set_load_tag(const char *tag);
+int jit_load_print(char *buf, size_t len);
+
+#endif /* _JIT_STREAM_H */
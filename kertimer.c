@@ -1,5 +1,11 @@
 /*
  * kertimer.c - testing the Kernel timer api <linux/timer.h>
+ *
+ * Creates `num_devices` minors, /dev/kertimer0 and on. Each has its own
+ * timer, armed `delay` jiffies ahead by every read, and its own one-byte
+ * store; counters are in /sys/class/dd/kertimer<n>/stats, histograms in
+ * /sys/kernel/debug/dd/kertimer<n>. The KT_IOC_CANCEL ioctl cancels the
+ * timer again (see kertimer_ioctl.h).
  */
 
 #include <linux/kernel.h>	/* printk defn */
@@ -10,78 +16,96 @@
 #include <linux/fs.h>		/* alloc_chrdev_region defn */
 #include <linux/device.h>
 #include <linux/cdev.h>		/* cdev_add and cdev_init */
-#include <linux/uaccess.h>	/* copy_to_user and copy_from_user */
+#include <linux/uio.h>		/* struct iov_iter */
 #include <linux/timer.h>
 #include <linux/sched.h>	/* jiffies */
+#include <linux/cache.h>	/* ____cacheline_aligned_in_smp */
 
-static dev_t first;		/* Global var. for first dev number */
-static struct cdev c_dev;	/* Global variable for the char device structure */
-static struct class *cl;	/* Global variable for the device class */
+#include "dd_compat.h"
+#include "dd_core.h"
+#include "dd_param.h"
+#include "kertimer_core.h"	/* the timer and data path proper */
+#include "kertimer_ioctl.h"
 
-static struct timer_list lazy_timer;
-static int delay	= HZ;
+static int num_devices = 1;	/* minors, each with a timer of its own */
+module_param(num_devices, int, 0444);
+
+static int delay	= HZ;	/* jiffies from a read to the timer firing */
+
+DD_PARAM(delay, int, 1, 60 * HZ, NULL);
+
+/* One per minor, on cache lines of its own */
+struct kt_dev {
+	struct kt_core kt;
+	int minor;
+} ____cacheline_aligned_in_smp;
 
 /* the procrastinating function */
-static void lazy(unsigned long arg)
+static void lazy(struct timer_list *t)
 {
-	pr_info("Lazy finally waking up....");
+	struct kt_core *kt = timer_container_of(kt, t, timer);
+	struct kt_dev *kd = container_of(kt, struct kt_dev, kt);
+
+	pr_debug("Lazy finally waking up on kertimer%d....", kd->minor);
 }
 
 /* Open and Close */
 
 static int kt_open(struct inode *i, struct file *filp)
 {
-	pr_info("Driver: open()\n");
+	pr_debug("Driver: open()\n");
+	filp->private_data = dd_chrdev_priv(i);
+	dd_stat_inc(dd_file_stats(filp), DD_OPENS);
 	return 0;
 }
 
 static int kt_close(struct inode *i, struct file *filp)
 {
-	pr_info("Driver: close()\n");
+	pr_debug("Driver: close()\n");
 	return 0;
 }
 
 /* Data Management */
 
-static char c;
+static ssize_t kt_read_iter(struct kiocb *iocb, struct iov_iter *to)
+{
+	struct kt_dev *kd = iocb->ki_filp->private_data;
+	u64 t0 = ktime_get_ns();
+	ssize_t ret;
+
+	pr_debug("In Read Method just before timer switched on");
+
+	/* reads may come faster than the timer expires: re-arm, don't re-add */
+	kt_core_arm(&kd->kt, READ_ONCE(delay));
+
+	pr_debug("Driver: read()\n");
+	ret = ofd_store_read(&kd->kt.store, to, &iocb->ki_pos);
+	dd_stat_io(dd_file_stats(iocb->ki_filp), DD_READS, ret, t0);
+	return ret;
+}
 
-static ssize_t kt_read(struct file *filp, char __user *buf, size_t len,
-		       loff_t *off)
+static ssize_t kt_write_iter(struct kiocb *iocb, struct iov_iter *from)
 {
-	unsigned long j		= jiffies;
-	unsigned long data	= 9687;		/* temporary fix */
-
-	pr_info("In Read Method just before timer switched on");
-
-	init_timer(&lazy_timer);
-	lazy_timer.data		= data;
-	lazy_timer.function	= lazy;
-	lazy_timer.expires	= j + delay;
-	add_timer(&lazy_timer);
-
-	pr_info("Driver: read()\n");
-	if (*off == 0) {
-		if (copy_to_user(buf, &c, 1) != 0)
-			return -EFAULT;
-		else {
-			(*off)++;
-			return 1;
-		}
-	}
-	else {
-		return 0;
-	}
+	struct kt_dev *kd = iocb->ki_filp->private_data;
+	u64 t0 = ktime_get_ns();
+	ssize_t ret;
+
+	pr_debug("Driver: write()\n");
+	ret = ofd_store_write(&kd->kt.store, from);
+	dd_stat_io(dd_file_stats(iocb->ki_filp), DD_WRITES, ret, t0);
+	return ret;
 }
 
-static ssize_t kt_write(struct file *filp, const char __user *buf,
-			 size_t len, loff_t *off)
+static long kt_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 {
-	pr_info("Driver: write()\n");
-	if (copy_from_user(&c, buf + (len - 1), 1) != 0)
-		return -EFAULT;
-	else
-		printk("%s", &c);
-		return len;
+	struct kt_dev *kd = filp->private_data;
+
+	switch (cmd) {
+	case KT_IOC_CANCEL:
+		return kt_core_cancel(&kd->kt);
+	default:
+		return -ENOTTY;
+	}
 }
 
 /*
@@ -92,45 +116,69 @@ static struct file_operations kt_fops = {
 	.owner	 = THIS_MODULE,
 	.open    = kt_open,
 	.release = kt_close,
-	.read	 = kt_read,
-	.write	 = kt_write
+	.read_iter  = kt_read_iter,
+	.write_iter = kt_write_iter,
+	.unlocked_ioctl = kt_ioctl,
+	.compat_ioctl = compat_ptr_ioctl
 };
 
-static int __init kt_init(void)
+/* /sys/class/dd/kertimer<n>/stats */
+static ssize_t stats_show(struct device *dev, struct device_attribute *attr,
+			  char *buf)
 {
-	pr_info("Bonjour! Kertimer registred");
+	struct kt_dev *kd = dev_get_drvdata(dev);
+	struct ofd_stats st;
 
-	if (alloc_chrdev_region(&first, 0, 1, "kertimer") < 0)
-		return -1;
+	ofd_store_stats(&kd->kt.store, &st);
+	return scnprintf(buf, PAGE_SIZE, "reads %lu writes %lu bytes_read %llu "
+			 "bytes_written %llu\n", st.reads, st.writes,
+			 st.bytes_read, st.bytes_written);
+}
+static DEVICE_ATTR_RO(stats);
 
-	if ((cl = class_create(THIS_MODULE, "chardrv")) == NULL) {
-		unregister_chrdev_region(first, 1);
-		return -1;
-	}
+static struct attribute *kt_attrs[] = {
+	&dev_attr_stats.attr,
+	NULL
+};
+ATTRIBUTE_GROUPS(kt);
 
-	if (device_create(cl, NULL, first, NULL, "kertimer") == NULL) {
-		class_destroy(cl);
-		unregister_chrdev_region(first, 1);
-		return -1;
-	}
+static int kt_setup(void *priv, int minor)
+{
+	struct kt_dev *kd = priv;
 
-	/* initialize the char device structure */
-	cdev_init(&c_dev, &kt_fops);
-	if (cdev_add(&c_dev, first, 1) == -1) {
-		device_destroy(cl, first);
-		class_destroy(cl);
-		unregister_chrdev_region(first, 1);
-		return -1;
-	}
+	kd->minor = minor;
+	kt_core_init(&kd->kt, lazy);
 	return 0;
 }
 
+static void kt_teardown(void *priv, int minor)
+{
+	struct kt_dev *kd = priv;
+
+	kt_core_cancel(&kd->kt);
+}
+
+static struct dd_chrdev kt_chrdev = {
+	.name		= "kertimer",
+	.node		= "kertimer%d",
+	.fops		= &kt_fops,
+	.groups		= kt_groups,
+	.priv_size	= sizeof(struct kt_dev),
+	.setup		= kt_setup,
+	.teardown	= kt_teardown
+};
+
+static int __init kt_init(void)
+{
+	pr_info("Bonjour! Kertimer registred");
+
+	kt_chrdev.count = num_devices;
+	return dd_chrdev_register(&kt_chrdev);
+}
+
 static void __exit kt_exit(void)
 {
-	cdev_del(&c_dev);
-	device_destroy(cl, first);
-	class_destroy(cl);
-	unregister_chrdev_region(first, 1);
+	dd_chrdev_unregister(&kt_chrdev);
 	pr_info("Au revour! kertimer unregistered");
 }
 
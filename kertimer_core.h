@@ -0,0 +1,46 @@
+/*
+ * kertimer_core.h -- the timer handling of kertimer, kept free of driver
+ * plumbing so it builds in user space too (see userbench/kshim.h)
+ *
+ * Besides the timer, kertimer keeps the same one-byte store as ofd.
+ */
+
+#ifndef _KERTIMER_CORE_H
+#define _KERTIMER_CORE_H
+
+#ifdef __KERNEL__
+#include <linux/timer.h>
+#include <linux/jiffies.h>
+#include "dd_compat.h"		/* timer_setup() and friends on old kernels */
+#else
+#include "userbench/kshim.h"
+#endif
+
+#include "ofd_core.h"
+
+struct kt_core {
+	struct timer_list timer;
+	struct ofd_store store;
+};
+
+/* fn gets &kt->timer; timer_container_of() leads back to kt */
+static inline void kt_core_init(struct kt_core *kt,
+				void (*fn)(struct timer_list *))
+{
+	timer_setup(&kt->timer, fn, 0);
+	ofd_store_init(&kt->store);
+}
+
+/* (Re)arm the timer `delay` jiffies from now, pending or not */
+static inline void kt_core_arm(struct kt_core *kt, unsigned long delay)
+{
+	mod_timer(&kt->timer, jiffies + delay);
+}
+
+/* 1 if the timer was pending, 0 if not */
+static inline int kt_core_cancel(struct kt_core *kt)
+{
+	return timer_delete_sync(&kt->timer);
+}
+
+#endif /* _KERTIMER_CORE_H */
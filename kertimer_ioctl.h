@@ -0,0 +1,20 @@
+/*
+ * kertimer_ioctl.h -- what user space needs to talk to kertimer
+ *
+ * Every read() of a minor (re)arms its timer `delay` jiffies ahead;
+ * KT_IOC_CANCEL takes it back, waiting out the handler if it is running,
+ * and returns 1 if the timer was still pending, 0 if not.
+ *
+ *	pread(fd, &c, 1, 0);
+ *	pending = ioctl(fd, KT_IOC_CANCEL);
+ */
+
+#ifndef _KERTIMER_IOCTL_H
+#define _KERTIMER_IOCTL_H
+
+#include <linux/ioctl.h>
+
+#define KT_IOC_MAGIC		'K'
+#define KT_IOC_CANCEL		_IO(KT_IOC_MAGIC, 1)
+
+#endif /* _KERTIMER_IOCTL_H */
@@ -1,5 +1,63 @@
 /*
  * ofd.c - A hello world driver
+ *
+ * Creates `num_devices` minors, /dev/mynull0 and on, each remembering the
+ * last byte written to it. What went through a minor is counted in
+ * /sys/class/dd/mynull<n>/stats, and in more detail, with size and latency
+ * histograms, in /sys/kernel/debug/dd/mynull<n>.
+ *
+ * With `ring_size` set, each minor is instead a ring buffer of that many
+ * bytes (rounded up to a power of two): reads take what writes put in,
+ * blocking while it is empty, writes block while it is full. The ring can
+ * be mmap()ed, read-only (MAP_SHARED, PROT_READ), to look at in place;
+ * what is in it is only ever the kernel's to change.
+ * /sys/class/dd/mynull<n>/ring has its head and tail. With `ring_huge`
+ * the ring is a compound page, physically contiguous and mapped with PMDs
+ * where it is big enough for them; if no such page is to be had, or
+ * without `ring_huge`, it is vmalloc()ed.
+ *
+ * Minors and their rings are allocated on NUMA node `node`, if given.
+ * With `ring_percpu` a minor has a ring per CPU instead, each on its CPU's
+ * node: writes go to the writer's CPU's ring, reads take from their own
+ * CPU's ring first and the others after. Mapped, CPU n's ring is at
+ * offset n * ring size. A read, OFD_IOC_READ_BATCH included, takes from
+ * one ring only, the first it finds anything in, so a batch is only ever
+ * one CPU's records.
+ *
+ * With `ring_records` the rings carry records instead of a byte stream:
+ * each write() is one record, each read() returns one whole record, or
+ * fails with -EMSGSIZE if the buffer is too small for it, and the
+ * OFD_IOC_READ_BATCH ioctl takes as many as fit in one go (see
+ * ofd_ioctl.h). A writer waits for room for the whole record.
+ *
+ * `ring_overwrite`, which implies `ring_records`, makes each ring a flight
+ * recorder instead: a write to a full ring drops the oldest records to
+ * make room, so writers never wait for it. Records carry their ring's
+ * sequence number, which is how readers tell what they missed; the count
+ * dropped is in /sys/class/dd/mynull<n>/ring. With `ring_percpu` as well
+ * a write costs a record's copy and no more, on the writer's own ring, and
+ * what is left after an incident can be read out, or looked at in place
+ * through mmap().
+ *
+ * `ring_crc`, which also implies `ring_records`, stores a CRC32C of every
+ * record with it and checks it when the record is read; failures are
+ * counted as "bad" in /sys/class/dd/mynull<n>/ring, as are records whose
+ * header doesn't add up, in any record mode.
+ *
+ * `ring_lz4`, which implies `ring_records` too, keeps records LZ4-compressed
+ * in the ring, each on its own, and decompresses them for readers, so a
+ * ring holds more of them if they compress well. How well, and the time
+ * spent each way, is in /sys/class/dd/mynull<n>/ring. It needs a kernel
+ * with LZ4 built (CONFIG_LZ4_COMPRESS and CONFIG_LZ4_DECOMPRESS), and
+ * makes the mapped ring hard to make sense of.
+ *
+ * A blocking read of an empty ring spins for a while before it sleeps, for
+ * as long as recent waits say data is likely to come (see dd_spin.h), up
+ * to `spin_ns`, or /sys/class/dd/mynull<n>/spin_ns per minor.
+ *
+ * O_NONBLOCK files and IOCB_NOWAIT requests, which is how io_uring tries
+ * them inline, wait neither for data or room nor for a ring's lock: they
+ * fail with -EAGAIN instead, and poll() says when to try again.
  */
 
 #include <linux/kernel.h>	/* printk defn */
@@ -10,12 +68,204 @@
 #include <linux/fs.h>		/* alloc_chrdev_region defn */
 #include <linux/device.h>
 #include <linux/cdev.h>		/* cdev_add and cdev_init */
-#include <linux/uaccess.h>	/* copy_to_user and copy_from_user */
+#include <linux/uio.h>		/* struct iov_iter */
+#include <linux/cache.h>	/* ____cacheline_aligned_in_smp */
+#include <linux/mm.h>
+#include <linux/gfp.h>
+#include <linux/vmalloc.h>
+#include <linux/log2.h>		/* roundup_pow_of_two() */
+#include <linux/percpu.h>
+#include <linux/cpumask.h>
+#include <linux/numa.h>
+#include <linux/poll.h>
+#include <linux/uaccess.h>	/* copy_from_user and copy_to_user */
+#include <linux/compat.h>	/* compat_ptr_ioctl */
+
+#include "dd_compat.h"
+#include "dd_core.h"
+#include "dd_spin.h"
+#include "ofd_core.h"		/* the data path proper */
+#include "ofd_ring.h"		/* and in ring mode */
+#include "ofd_ioctl.h"
 //#include "/home/lym/kernel_src/devel/tools/lib/lockdep/uinclude/linux/kern_levels.h" /* defines the kernel log-levels */
 
-static dev_t first;		/* Global var. for first dev number */
-static struct cdev c_dev;	/* Global variable for the char device structure */
-static struct class *cl;	/* Global variable for the device class */
+static int num_devices = 1;	/* minors, each a device of its own */
+module_param(num_devices, int, 0444);
+
+static unsigned int ring_size;	/* bytes per minor; 0: the last-byte store */
+module_param(ring_size, uint, 0444);
+
+static bool ring_huge;		/* back the ring with a compound page */
+module_param(ring_huge, bool, 0444);
+
+static bool ring_percpu;	/* a ring per CPU, on the CPU's node */
+module_param(ring_percpu, bool, 0444);
+
+static bool ring_records;	/* records rather than a byte stream */
+module_param(ring_records, bool, 0444);
+
+static bool ring_overwrite;	/* full rings drop their oldest records */
+module_param(ring_overwrite, bool, 0444);
+
+static unsigned int spin_ns;	/* most a reader spins before sleeping */
+module_param(spin_ns, uint, 0444);
+
+static bool ring_crc;		/* checksum every record */
+module_param(ring_crc, bool, 0444);
+
+static bool ring_lz4;		/* compress records in the ring */
+module_param(ring_lz4, bool, 0444);
+
+static int node = NUMA_NO_NODE;	/* for the minors and single rings */
+module_param(node, int, 0444);
+
+#define OFD_RING_MAX	(1U << 30)
+
+/* A ring and where its memory is */
+struct ofd_shard {
+	struct ofd_ring ring;		/* ring.buf is NULL but in ring mode */
+	bool compound;			/* ring.buf is a compound page */
+	int nid;
+} ____cacheline_aligned_in_smp;
+
+/* One per minor, on cache lines of its own so busy minors don't collide */
+struct ofd_dev {
+	struct ofd_store store;
+	int nid;			/* of this struct, and so the store */
+	struct ofd_shard ring;		/* in ring mode, without ring_percpu */
+	struct ofd_shard __percpu *shards;	/* with ring_percpu */
+	wait_queue_head_t rwait;	/* readers of the shards, for any */
+	struct dd_spin spin;		/* how long readers poll first */
+} ____cacheline_aligned_in_smp;
+
+/*
+ * The rings
+ */
+
+/* The ring a write from this CPU goes to */
+static struct ofd_shard *ofd_shard_local(struct ofd_dev *od)
+{
+	return od->shards ? per_cpu_ptr(od->shards, raw_smp_processor_id()) :
+		&od->ring;
+}
+
+static size_t ofd_shards_used(struct ofd_dev *od)
+{
+	size_t used = 0;
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		used += ofd_ring_used(&per_cpu_ptr(od->shards, cpu)->ring);
+	return used;
+}
+
+/* Whether a read would find anything, in any ring */
+static bool ofd_readable(struct ofd_dev *od)
+{
+	return od->shards ? ofd_shards_used(od) != 0 :
+		ofd_ring_used(&od->ring.ring) != 0;
+}
+
+static int ofd_next_cpu(int cpu)
+{
+	cpu = cpumask_next(cpu, cpu_possible_mask);
+	return cpu < nr_cpu_ids ? cpu : cpumask_first(cpu_possible_mask);
+}
+
+/* A shard's ring as bytes or as records; batch only applies to records */
+static ssize_t ofd_shard_read(struct ofd_shard *sh, struct iov_iter *to,
+			      int nonblock, unsigned int *batch)
+{
+	if (ring_records)
+		return ofd_ring_read_rec(&sh->ring, to, nonblock, batch);
+	return ofd_ring_read(&sh->ring, to, nonblock);
+}
+
+static ssize_t ofd_shard_write(struct ofd_shard *sh, struct iov_iter *from,
+			       int nonblock)
+{
+	if (ring_records)
+		return ofd_ring_write_rec(&sh->ring, from, nonblock);
+	return ofd_ring_write(&sh->ring, from, nonblock);
+}
+
+static ssize_t ofd_rings_read(struct ofd_dev *od, struct iov_iter *to,
+			      int nonblock, unsigned int *batch,
+			      struct dd_stats __percpu *st)
+{
+	struct ofd_shard *sh;
+	ssize_t ret;
+	int cpu, start;
+
+	if (!od->shards) {
+		dd_stat_remote(st, od->ring.nid);
+		return ofd_shard_read(&od->ring, to, nonblock, batch);
+	}
+
+	for (;;) {
+		/*
+		 * Our own CPU's ring first, then the others in turn. Blocking
+		 * readers wait for the lock of a ring that has something, so a
+		 * writer holding it doesn't send them round in circles.
+		 */
+		cpu = start = raw_smp_processor_id();
+		do {
+			sh = per_cpu_ptr(od->shards, cpu);
+			ret = ofd_shard_read(sh, to, !nonblock &&
+					     ofd_ring_used(&sh->ring) ?
+					     OFD_RING_LOCK_ONLY :
+					     OFD_RING_NONBLOCK, batch);
+			if (ret != -EAGAIN) {
+				dd_stat_remote(st, sh->nid);
+				return ret;
+			}
+			cpu = ofd_next_cpu(cpu);
+		} while (cpu != start);
+
+		if (nonblock)
+			return -EAGAIN;
+		if (wait_event_interruptible(od->rwait,
+					     ofd_shards_used(od) != 0))
+			return -ERESTARTSYS;
+	}
+}
+
+/*
+ * A reader that would block spins first, and what its wait took, spinning
+ * or asleep, goes into how long the next one spins
+ */
+static ssize_t ofd_ring_mode_read(struct ofd_dev *od, struct iov_iter *to,
+				  int nonblock, unsigned int *batch,
+				  struct dd_stats __percpu *st)
+{
+	u64 t0;
+	bool spun;
+	ssize_t ret;
+
+	if (nonblock || ofd_readable(od))
+		return ofd_rings_read(od, to, nonblock, batch, st);
+
+	t0 = dd_spin_start(&od->spin);
+	spun = dd_spin_until(&od->spin, t0, ofd_readable(od));
+	dd_stat_inc(st, spun ? DD_SPINS : DD_WAITS);
+	ret = ofd_rings_read(od, to, nonblock, batch, st);
+	if (ret >= 0)
+		dd_spin_learn(&od->spin, t0);
+	return ret;
+}
+
+static ssize_t ofd_ring_mode_write(struct ofd_dev *od, struct iov_iter *from,
+				   int nonblock, struct dd_stats __percpu *st)
+{
+	struct ofd_shard *sh = ofd_shard_local(od);
+	ssize_t ret;
+
+	dd_stat_remote(st, sh->nid);
+	ret = ofd_shard_write(sh, from, nonblock);
+	if (ret > 0 && od->shards)
+		wake_up_interruptible(&od->rwait);
+	return ret;
+}
 
 /*
  * Open and Close
@@ -23,13 +273,19 @@ static struct class *cl;	/* Global variable for the device class */
 
 static int ofd_open(struct inode *i, struct file *filp)
 {
-	printk(KERN_INFO "Driver: open()\n");
+	pr_debug("Driver: open()\n");
+	filp->private_data = dd_chrdev_priv(i);
+#ifdef FMODE_NOWAIT
+	/* nothing here blocks under IOCB_NOWAIT: io_uring may issue inline */
+	filp->f_mode |= FMODE_NOWAIT;
+#endif
+	dd_stat_inc(dd_file_stats(filp), DD_OPENS);
 	return 0;
 }
 
 static int ofd_close(struct inode *i, struct file *filp)
 {
-	printk(KERN_INFO "Driver: close()\n");
+	pr_debug("Driver: close()\n");
 	return 0;
 }
 
@@ -37,35 +293,221 @@ static int ofd_close(struct inode *i, struct file *filp)
  * Data Management
  */
 
-static char c;
+/* Don't wait, for data or for the lock, if the caller can't */
+static int ofd_nonblock(struct kiocb *iocb)
+{
+	return (iocb->ki_flags & IOCB_NOWAIT) ||
+		(iocb->ki_filp->f_flags & O_NONBLOCK);
+}
 
-static ssize_t ofd_read(struct file *filp, char __user *buf, size_t len,
-		       loff_t *off)
+static ssize_t ofd_read_iter(struct kiocb *iocb, struct iov_iter *to)
 {
-	printk(KERN_INFO "Driver: read()\n");
-	if (*off == 0) {
-		if (copy_to_user(buf, &c, 1) != 0)
-			return -EFAULT;
-		else {
-			(*off)++;
-			return 1;
-		}
+	struct ofd_dev *od = iocb->ki_filp->private_data;
+	struct dd_stats __percpu *st = dd_file_stats(iocb->ki_filp);
+	u64 t0 = ktime_get_ns();
+	ssize_t ret;
+
+	pr_debug("Driver: read()\n");
+	if (ring_size) {
+		ret = ofd_ring_mode_read(od, to, ofd_nonblock(iocb), NULL, st);
+	} else {
+		dd_stat_remote(st, od->nid);
+		ret = ofd_store_read(&od->store, to, &iocb->ki_pos);
 	}
-	else {
-		return 0;
+	dd_stat_io(st, DD_READS, ret, t0);
+	return ret;
+}
+
+static ssize_t ofd_write_iter(struct kiocb *iocb, struct iov_iter *from)
+{
+	struct ofd_dev *od = iocb->ki_filp->private_data;
+	struct dd_stats __percpu *st = dd_file_stats(iocb->ki_filp);
+	u64 t0 = ktime_get_ns();
+	ssize_t ret;
+
+	pr_debug("Driver: write()\n");
+	if (ring_size) {
+		ret = ofd_ring_mode_write(od, from, ofd_nonblock(iocb), st);
+	} else {
+		dd_stat_remote(st, od->nid);
+		ret = ofd_store_write(&od->store, from);
 	}
+	dd_stat_io(st, DD_WRITES, ret, t0);
+	return ret;
 }
 
-static ssize_t ofd_write(struct file *filp, const char __user *buf,
-			 size_t len, loff_t *off)
+/*
+ * OFD_IOC_READ_BATCH: whole records, headers and all, into the caller's
+ * buffer, counted as one read
+ */
+static long ofd_read_batch(struct file *filp, struct ofd_batch __user *ub)
 {
-	printk(KERN_INFO "Driver: write()\n");
-	if (copy_from_user(&c, buf + (len - 1), 1) != 0)
+	struct ofd_dev *od = filp->private_data;
+	struct dd_stats __percpu *st = dd_file_stats(filp);
+	void __user *buf;
+	struct ofd_batch b;
+	struct iovec iov;
+	struct iov_iter iter;
+	u64 t0 = ktime_get_ns();
+	ssize_t ret;
+
+	if (!ring_size || !ring_records)
+		return -EINVAL;
+	if (copy_from_user(&b, ub, sizeof(b)))
 		return -EFAULT;
-	else
-		printk("%s", &c);
-		return len;
+	buf = u64_to_user_ptr(b.buf);
+	if (!dd_access_ok(buf, b.len))
+		return -EFAULT;
+
+	iov.iov_base = buf;
+	iov.iov_len = b.len;
+	iov_iter_init(&iter, READ, &iov, 1, b.len);
+	b.nr = 0;
+	ret = ofd_ring_mode_read(od, &iter, !!(filp->f_flags & O_NONBLOCK),
+				 &b.nr, st);
+	dd_stat_io(st, DD_READS, ret, t0);
+	if (ret >= 0 && put_user(b.nr, &ub->nr))
+		return -EFAULT;
+	return ret;
+}
+
+static long ofd_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
+{
+	switch (cmd) {
+	case OFD_IOC_READ_BATCH:
+		return ofd_read_batch(filp, (struct ofd_batch __user *) arg);
+	default:
+		return -ENOTTY;
+	}
+}
+
+/*
+ * Readable while there is data in any ring, writable while this CPU's
+ * ring has room, which an overwriting ring always has; the store is always
+ * both
+ */
+static __poll_t ofd_poll(struct file *filp, poll_table *wait)
+{
+	struct ofd_dev *od = filp->private_data;
+	struct ofd_shard *sh;
+	__poll_t mask = 0;
+
+	if (!ring_size)
+		return EPOLLIN | EPOLLRDNORM | EPOLLOUT | EPOLLWRNORM;
+
+	sh = ofd_shard_local(od);
+	poll_wait(filp, od->shards ? &od->rwait : &sh->ring.rwait, wait);
+	poll_wait(filp, &sh->ring.wwait, wait);
+	if (ofd_readable(od))
+		mask |= EPOLLIN | EPOLLRDNORM;
+	if (ring_overwrite || ofd_ring_used(&sh->ring) < sh->ring.size)
+		mask |= EPOLLOUT | EPOLLWRNORM;
+	return mask;
+}
+
+/*
+ * Mapping the ring
+ *
+ * The mapping is VM_PFNMAP and filled in a page, or a PMD, at a time as
+ * it is faulted in. An open mapping holds the file and so the module,
+ * which is what keeps the ring from going away under it.
+ */
+#ifdef DD_HAVE_MMAP
+/* The ring at offset off of the mapping, and the offset into it */
+static struct ofd_shard *ofd_shard_at(struct ofd_dev *od, size_t *off)
+{
+	size_t size = od->ring.ring.size;
+	unsigned long idx;
+
+	if (od->shards)
+		size = per_cpu_ptr(od->shards, cpumask_first(cpu_possible_mask))
+			->ring.size;
+	idx = *off / size;
+	*off %= size;
+
+	if (!od->shards)
+		return idx ? NULL : &od->ring;
+	if (idx >= nr_cpu_ids || !cpu_possible(idx))
+		return NULL;
+	return per_cpu_ptr(od->shards, idx);
+}
+
+static unsigned long ofd_ring_pfn(struct ofd_shard *sh, size_t off)
+{
+	void *p = sh->ring.buf + off;
+
+	return is_vmalloc_addr(p) ? vmalloc_to_pfn(p) :
+		virt_to_phys(p) >> PAGE_SHIFT;
+}
+
+static vm_fault_t ofd_vm_fault(struct vm_fault *vmf)
+{
+	struct vm_area_struct *vma = vmf->vma;
+	size_t off = vmf->pgoff << PAGE_SHIFT;
+	struct ofd_shard *sh = ofd_shard_at(vma->vm_private_data, &off);
+
+	if (!sh)
+		return VM_FAULT_SIGBUS;
+	return vmf_insert_pfn(vma, vmf->address & PAGE_MASK,
+			      ofd_ring_pfn(sh, off));
+}
+
+#ifdef DD_HAVE_HUGE_MMAP
+/* Only a compound page is known to be contiguous; the rest falls back */
+static vm_fault_t ofd_vm_huge_fault(struct vm_fault *vmf, dd_fault_size size)
+{
+	struct vm_area_struct *vma = vmf->vma;
+	unsigned long addr = vmf->address & PMD_MASK;
+	size_t off = (addr - vma->vm_start) + (vma->vm_pgoff << PAGE_SHIFT);
+	struct ofd_shard *sh;
+
+	if (size != DD_FAULT_PMD ||
+	    addr < vma->vm_start || addr + PMD_SIZE > vma->vm_end)
+		return VM_FAULT_FALLBACK;
+	sh = ofd_shard_at(vma->vm_private_data, &off);
+	if (!sh || !sh->compound ||
+	    (off & ~PMD_MASK) || off + PMD_SIZE > sh->ring.size)
+		return VM_FAULT_FALLBACK;
+	return dd_vmf_insert_pfn_pmd(vmf, ofd_ring_pfn(sh, off),
+				     vmf->flags & FAULT_FLAG_WRITE);
+}
+#endif
+
+static const struct vm_operations_struct ofd_vm_ops = {
+	.fault		= ofd_vm_fault,
+#ifdef DD_HAVE_HUGE_MMAP
+	.huge_fault	= ofd_vm_huge_fault,
+#endif
+};
+
+static int ofd_mmap(struct file *filp, struct vm_area_struct *vma)
+{
+	struct ofd_dev *od = filp->private_data;
+	unsigned long pages = (vma->vm_end - vma->vm_start) >> PAGE_SHIFT;
+	unsigned long total;
+
+	if (!ring_size)
+		return -ENODEV;
+	/* a private mapping would want copy-on-write, which pfns can't do */
+	if (!(vma->vm_flags & VM_SHARED))
+		return -EINVAL;
+	/* nor can user space be let at the records' headers */
+	if (vma->vm_flags & VM_WRITE)
+		return -EPERM;
+	total = (roundup_pow_of_two(max_t(size_t, ring_size, PAGE_SIZE)) >>
+		 PAGE_SHIFT) * (od->shards ? nr_cpu_ids : 1);
+	if (vma->vm_pgoff > total || pages > total - vma->vm_pgoff)
+		return -EINVAL;
+
+	vm_flags_set(vma, VM_PFNMAP | VM_DONTEXPAND | VM_DONTDUMP);
+	vm_flags_clear(vma, VM_MAYWRITE);
+	if (ring_huge)
+		vm_flags_set(vma, VM_HUGEPAGE);
+	vma->vm_ops		= &ofd_vm_ops;
+	vma->vm_private_data	= od;
+	return 0;
 }
+#endif /* DD_HAVE_MMAP */
 
 /*
  * Add the device-specific file operations to the file_operations structure
@@ -75,46 +517,266 @@ static struct file_operations ofd_fops = {
 	.owner	 = THIS_MODULE,
 	.open    = ofd_open,
 	.release = ofd_close,
-	.read	 = ofd_read,
-	.write	 = ofd_write
+	.read_iter  = ofd_read_iter,
+	.write_iter = ofd_write_iter,
+	.poll	 = ofd_poll,
+	.unlocked_ioctl = ofd_ioctl,
+	.compat_ioctl	= compat_ptr_ioctl,	/* struct ofd_batch is the same */
+#ifdef DD_HAVE_MMAP
+	.mmap	 = ofd_mmap,
+#endif
+#ifdef DD_HAVE_HUGE_MMAP
+	/* PMD-aligned addresses for mappings big enough to use them */
+	.get_unmapped_area = thp_get_unmapped_area,
+#endif
 };
 
-static int __init ofd_init(void)	/* constructor */
+/* /sys/class/dd/mynull<n>/stats */
+static ssize_t stats_show(struct device *dev, struct device_attribute *attr,
+			  char *buf)
 {
-	printk(KERN_INFO "Bonjour! ofd registred");
+	struct ofd_dev *od = dev_get_drvdata(dev);
+	struct ofd_stats st;
+
+	ofd_store_stats(&od->store, &st);
+	return scnprintf(buf, PAGE_SIZE, "reads %lu writes %lu bytes_read %llu "
+			 "bytes_written %llu\n", st.reads, st.writes,
+			 st.bytes_read, st.bytes_written);
+}
+static DEVICE_ATTR_RO(stats);
+
+/*
+ * "<head> <tail> <node> <backing>" of a ring, and in record mode the
+ * records written, dropped and found bad (failing their checksum, or
+ * with a header that makes no sense), and with compression the payload
+ * bytes that went in, what they took in the ring, and the nanoseconds
+ * spent compressing and decompressing them
+ */
+static int ofd_shard_show(struct ofd_shard *sh, char *buf, size_t len)
+{
+	u64 head, tail, seq, lost, bad, lz4_in, lz4_out, lz4_ns, unlz4_ns;
+	int n;
+
+	mutex_lock(&sh->ring.lock);
+	head = sh->ring.head;
+	tail = sh->ring.tail;
+	seq = sh->ring.seq;
+	lost = sh->ring.lost;
+	bad = sh->ring.bad;
+	lz4_in = sh->ring.lz4_in;
+	lz4_out = sh->ring.lz4_out;
+	lz4_ns = sh->ring.lz4_ns;
+	unlz4_ns = sh->ring.unlz4_ns;
+	mutex_unlock(&sh->ring.lock);
+	n = scnprintf(buf, len, "head %llu tail %llu node %d %s", head, tail,
+		      sh->nid, sh->compound ? "compound" : "vmalloc");
+	if (ring_records)
+		n += scnprintf(buf + n, len - n, " seq %llu lost %llu bad %llu",
+			       seq, lost, bad);
+	if (ring_lz4)
+		n += scnprintf(buf + n, len - n, " lz4_in %llu lz4_out %llu "
+			       "lz4_ns %llu unlz4_ns %llu", lz4_in, lz4_out,
+			       lz4_ns, unlz4_ns);
+	return n + scnprintf(buf + n, len - n, "\n");
+}
+
+/*
+ * /sys/class/dd/mynull<n>/ring: the ring size, then for each ring its
+ * head, tail and where its memory is; rings per CPU are prefixed "cpu<n>"
+ */
+static ssize_t ring_show(struct device *dev, struct device_attribute *attr,
+			 char *buf)
+{
+	struct ofd_dev *od = dev_get_drvdata(dev);
+	struct ofd_shard *sh;
+	ssize_t n;
+	int cpu;
+
+	if (!ring_size)
+		return scnprintf(buf, PAGE_SIZE, "none\n");
+	if (!od->shards) {
+		n = scnprintf(buf, PAGE_SIZE, "size %zu ", od->ring.ring.size);
+		return n + ofd_shard_show(&od->ring, buf + n, PAGE_SIZE - n);
+	}
+
+	sh = per_cpu_ptr(od->shards, cpumask_first(cpu_possible_mask));
+	n = scnprintf(buf, PAGE_SIZE, "size %zu\n", sh->ring.size);
+	for_each_possible_cpu(cpu) {
+		n += scnprintf(buf + n, PAGE_SIZE - n, "cpu%d ", cpu);
+		n += ofd_shard_show(per_cpu_ptr(od->shards, cpu), buf + n,
+				    PAGE_SIZE - n);
+	}
+	return n;
+}
+static DEVICE_ATTR_RO(ring);
+
+/* /sys/class/dd/mynull<n>/spin_ns */
+static ssize_t spin_ns_show(struct device *dev, struct device_attribute *attr,
+			    char *buf)
+{
+	struct ofd_dev *od = dev_get_drvdata(dev);
 
-	if (alloc_chrdev_region(&first, 0, 1, "trivial_dev") < 0)
-		return -1;
+	return dd_spin_show(&od->spin, buf);
+}
+
+static ssize_t spin_ns_store(struct device *dev,
+			     struct device_attribute *attr, const char *buf,
+			     size_t count)
+{
+	struct ofd_dev *od = dev_get_drvdata(dev);
 
-	if ((cl = class_create(THIS_MODULE, "chardrv")) == NULL) {
-		unregister_chrdev_region(first, 1);
-		return -1;
+	return dd_spin_store(&od->spin, buf, count);
+}
+static DEVICE_ATTR_RW(spin_ns);
+
+static struct attribute *ofd_attrs[] = {
+	&dev_attr_stats.attr,
+	&dev_attr_ring.attr,
+	&dev_attr_spin_ns.attr,
+	NULL
+};
+ATTRIBUTE_GROUPS(ofd);
+
+static void ofd_shard_free(struct ofd_shard *sh)
+{
+	if (!sh->ring.buf)
+		return;
+	if (sh->compound)
+		__free_pages(virt_to_page(sh->ring.buf),
+			     get_order(sh->ring.size));
+	else
+		vfree(sh->ring.buf);
+	sh->ring.buf = NULL;
+	vfree(sh->ring.lz4_work);
+	vfree(sh->ring.lz4_buf);
+	sh->ring.lz4_work = sh->ring.lz4_buf = NULL;
+}
+
+/*
+ * Ring memory: a compound page if asked for and to be had, vmalloc()
+ * otherwise, on node nid unless that is NUMA_NO_NODE
+ */
+static int ofd_shard_alloc(struct ofd_shard *sh, size_t size, int nid,
+			   u32 id)
+{
+	struct page *page = NULL;
+	void *buf;
+
+	if (ring_huge) {
+		page = alloc_pages_node(nid, GFP_KERNEL | __GFP_COMP |
+					__GFP_ZERO | __GFP_NOWARN |
+					__GFP_NORETRY, get_order(size));
+		if (!page)
+			pr_info("ofd: no %zu byte compound page, using "
+				"vmalloc\n", size);
+	}
+
+	if (page) {
+		buf = page_address(page);
+		sh->compound = true;
+	} else {
+		buf = nid == NUMA_NO_NODE ? dd_vzalloc_huge(size) :
+			vzalloc_node(size, nid);
+		if (!buf)
+			return -ENOMEM;
+		page = vmalloc_to_page(buf);
+		sh->compound = false;
+	}
+	sh->nid = page_to_nid(page);
+	ofd_ring_init(&sh->ring, buf, size);
+	sh->ring.id = id;
+	sh->ring.overwrite = ring_overwrite;
+	sh->ring.crc = ring_crc;
+#ifdef DD_HAVE_LZ4
+	if (ring_lz4) {
+		sh->ring.lz4_work = vmalloc_node(LZ4_MEM_COMPRESS, sh->nid);
+		sh->ring.lz4_buf = vmalloc_node(OFD_LZ4_BUF, sh->nid);
+		if (!sh->ring.lz4_work || !sh->ring.lz4_buf) {
+			ofd_shard_free(sh);
+			return -ENOMEM;
+		}
 	}
+#endif
+	return 0;
+}
 
-	if (device_create(cl, NULL, first, NULL, "mynull") == NULL) {
-		class_destroy(cl);
-		unregister_chrdev_region(first, 1);
-		return -1;
+static void ofd_teardown(void *priv, int minor)
+{
+	struct ofd_dev *od = priv;
+	int cpu;
+
+	if (od->shards) {
+		for_each_possible_cpu(cpu)
+			ofd_shard_free(per_cpu_ptr(od->shards, cpu));
+		free_percpu(od->shards);
+		od->shards = NULL;
 	}
+	ofd_shard_free(&od->ring);
+}
+
+static int ofd_setup(void *priv, int minor)
+{
+	struct ofd_dev *od = priv;
+	size_t size;
+	int cpu, ret;
+
+	od->nid = page_to_nid(virt_to_page(od));
+	ofd_store_init(&od->store);
+	dd_spin_init(&od->spin, spin_ns);
+	if (!ring_size)
+		return 0;
+
+	size = roundup_pow_of_two(max_t(size_t, ring_size, PAGE_SIZE));
+	if (!ring_percpu)
+		return ofd_shard_alloc(&od->ring, size, node, 0);
 
-	/* initialize the char device structure */
-	cdev_init(&c_dev, &ofd_fops);
-	if (cdev_add(&c_dev, first, 1) == -1) {
-		device_destroy(cl, first);
-		class_destroy(cl);
-		unregister_chrdev_region(first, 1);
-		return -1;
+	init_waitqueue_head(&od->rwait);
+	od->shards = alloc_percpu(struct ofd_shard);
+	if (!od->shards)
+		return -ENOMEM;
+	for_each_possible_cpu(cpu) {
+		ret = ofd_shard_alloc(per_cpu_ptr(od->shards, cpu), size,
+				      cpu_to_node(cpu), cpu);
+		if (ret) {
+			ofd_teardown(od, minor);
+			return ret;
+		}
 	}
-	//printk(KERN_INFO "<Major, Minor>: <%d, %d>\n", MAJOR(first), MINOR(first));
 	return 0;
 }
 
+static struct dd_chrdev ofd_chrdev = {
+	.name		= "trivial_dev",
+	.node		= "mynull%d",
+	.fops		= &ofd_fops,
+	.groups		= ofd_groups,
+	.priv_size	= sizeof(struct ofd_dev),
+	.numa_node	= &node,
+	.setup		= ofd_setup,
+	.teardown	= ofd_teardown
+};
+
+static int __init ofd_init(void)	/* constructor */
+{
+	printk(KERN_INFO "Bonjour! ofd registred");
+
+	if (ring_size > OFD_RING_MAX || spin_ns > DD_SPIN_MAX_NS)
+		return -EINVAL;
+#ifndef DD_HAVE_LZ4
+	if (ring_lz4) {
+		pr_err("ofd: ring_lz4 needs a kernel with LZ4\n");
+		return -EINVAL;
+	}
+#endif
+	if (ring_overwrite || ring_crc || ring_lz4)
+		ring_records = true;
+	ofd_chrdev.count = num_devices;
+	return dd_chrdev_register(&ofd_chrdev);
+}
+
 static void __exit ofd_exit(void)	/* destructor */
 {
-	cdev_del(&c_dev);
-	device_destroy(cl, first);
-	class_destroy(cl);
-	unregister_chrdev_region(first, 1);
+	dd_chrdev_unregister(&ofd_chrdev);
 	printk(KERN_INFO "Au revour! ofd unregistered");
 }
 
@@ -0,0 +1,88 @@
+/*
+ * ofd_core.h -- the data path of ofd, kept free of driver plumbing
+ *
+ * This builds both in the kernel and, against userbench/kshim.h, in user
+ * space, so it can be benchmarked without loading a module.
+ */
+
+#ifndef _OFD_CORE_H
+#define _OFD_CORE_H
+
+#ifdef __KERNEL__
+#include <linux/types.h>
+#include <linux/string.h>
+#include <linux/spinlock.h>
+#include <linux/uio.h>		/* copy_to_iter and copy_from_iter */
+#else
+#include "userbench/kshim.h"
+#endif
+
+/* What went through a store, counted under its lock */
+struct ofd_stats {
+	unsigned long reads, writes;
+	u64 bytes_read, bytes_written;
+};
+
+/* Remembers the last byte written; a read at offset 0 returns it */
+struct ofd_store {
+	spinlock_t lock;
+	char c;
+	struct ofd_stats stats;
+};
+
+static inline void ofd_store_init(struct ofd_store *st)
+{
+	spin_lock_init(&st->lock);
+	st->c = 0;
+	memset(&st->stats, 0, sizeof(st->stats));
+}
+
+static inline void ofd_store_stats(struct ofd_store *st, struct ofd_stats *s)
+{
+	spin_lock(&st->lock);
+	*s = st->stats;
+	spin_unlock(&st->lock);
+}
+
+static inline ssize_t ofd_store_read(struct ofd_store *st, struct iov_iter *to,
+				     loff_t *off)
+{
+	char c;
+
+	if (*off != 0 || iov_iter_count(to) == 0)
+		return 0;
+
+	spin_lock(&st->lock);
+	c = st->c;
+	st->stats.reads++;
+	st->stats.bytes_read++;
+	spin_unlock(&st->lock);
+
+	/* never copy to user space with the lock held: it may fault */
+	if (copy_to_iter(&c, 1, to) != 1)
+		return -EFAULT;
+	(*off)++;
+	return 1;
+}
+
+static inline ssize_t ofd_store_write(struct ofd_store *st,
+				      struct iov_iter *from)
+{
+	size_t len = iov_iter_count(from);
+	char c;
+
+	if (len == 0)
+		return 0;
+	iov_iter_advance(from, len - 1);
+	if (copy_from_iter(&c, 1, from) != 1)
+		return -EFAULT;
+
+	spin_lock(&st->lock);
+	st->c = c;
+	st->stats.writes++;
+	st->stats.bytes_written += len;
+	spin_unlock(&st->lock);
+	return len;
+}
+
+#endif /* _OFD_CORE_H */
@@ -0,0 +1,62 @@
+/*
+ * ofd_ioctl.h -- what user space needs to talk to ofd's ring mode
+ *
+ * With `ring_records`, every write() to a ring is one record and every
+ * read() returns one whole record, or -EMSGSIZE if it doesn't fit.
+ * OFD_IOC_READ_BATCH takes as many whole records as fit in a buffer at
+ * once, each laid out as a struct ofd_rec followed by its payload:
+ *
+ *	struct ofd_batch b = { .buf = (uintptr_t) buf, .len = sizeof(buf) };
+ *	n = ioctl(fd, OFD_IOC_READ_BATCH, &b);
+ *	for (p = buf; b.nr--; p += sizeof(*rec) + rec->len) {
+ *		rec = (struct ofd_rec *) p;
+ *		... rec->len bytes of payload at p + sizeof(*rec) ...
+ *	}
+ *
+ * The ioctl returns the bytes filled in, like read(), and blocks, or fails
+ * with -EAGAIN, the same way.
+ *
+ * Each ring numbers its records from 0 in seq; a ring is named by ring,
+ * its CPU with `ring_percpu` and 0 otherwise. With `ring_overwrite` a full
+ * ring makes room by dropping its oldest records rather than making the
+ * writer wait, and a reader sees that as a gap in seq:
+ *
+ *	lost += rec->seq - next[rec->ring];
+ *	next[rec->ring] = rec->seq + 1;
+ *
+ * With `ring_crc`, crc is the CRC32C of the payload, taken as it went into
+ * the ring and checked again on the way out; a record that no longer
+ * matches is dropped, and the read that came to it fails with -EBADMSG.
+ * Without, crc is 0.
+ *
+ * With `ring_lz4`, payloads are kept LZ4-compressed in the ring where that
+ * makes them smaller, and zlen is what they took there; they are always
+ * read back whole, so it is only of interest to see how well that does.
+ * It is 0 for payloads kept as written.
+ */
+
+#ifndef _OFD_IOCTL_H
+#define _OFD_IOCTL_H
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+/* A record's header, in the ring and in a batch; not aligned */
+struct ofd_rec {
+	__u32 len;			/* of the payload that follows */
+	__u32 ring;			/* it was written to */
+	__u64 seq;			/* in that ring */
+	__u32 crc;			/* CRC32C of the payload, or 0 */
+	__u32 zlen;			/* of the payload compressed, or 0 */
+} __attribute__((packed));
+
+struct ofd_batch {
+	__u64 buf;			/* in: where to put the records */
+	__u32 len;			/* in: how much room there is */
+	__u32 nr;			/* out: how many records were put */
+};
+
+#define OFD_IOC_MAGIC		'O'
+#define OFD_IOC_READ_BATCH	_IOWR(OFD_IOC_MAGIC, 1, struct ofd_batch)
+
+#endif /* _OFD_IOCTL_H */
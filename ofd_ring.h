@@ -0,0 +1,514 @@
+/*
+ * ofd_ring.h -- the ring buffer behind ofd's ring mode, kept free of driver
+ * plumbing like ofd_core.h
+ *
+ * A byte ring of a power-of-two size: writers append at head, readers
+ * consume from tail, both free-running counters. User copies are made with
+ * the lock held, so it is a mutex; readers block while the ring is empty
+ * and writers while it is full. Where the memory comes from is up to the
+ * driver.
+ *
+ * The ring carries either a plain byte stream (ofd_ring_read/write) or
+ * records (ofd_ring_read_rec/write_rec), each a struct ofd_rec and its
+ * payload, which are only ever added and taken whole. A ring set to
+ * overwrite makes room for a record by dropping the oldest ones, so
+ * writers never wait for room, only for the lock. A ring set to crc checks
+ * every record against the CRC32C it was written with.
+ *
+ * Given work buffers (lz4_work and lz4_buf) the ring keeps each record of
+ * up to OFD_LZ4_MAX bytes LZ4-compressed, where that makes it smaller, and
+ * readers get it back as it was written. A record is one LZ4 block, so any
+ * one can be read, or dropped, without the others; small records gain
+ * little.
+ */
+
+#ifndef _OFD_RING_H
+#define _OFD_RING_H
+
+#ifdef __KERNEL__
+#include <linux/types.h>
+#include <linux/kernel.h>
+#include <linux/mutex.h>
+#include <linux/wait.h>
+#include <linux/sched.h>
+#include <linux/uio.h>		/* copy_to_iter and copy_from_iter */
+#ifdef HAVE_CRC32C_IN_CRC32
+#include <linux/crc32.h>
+#else
+#include <linux/crc32c.h>
+#endif
+#include "dd_compat.h"		/* LZ4, local_clock() */
+#else
+#include "userbench/kshim.h"
+#endif
+
+#include "ofd_ioctl.h"		/* struct ofd_rec */
+
+struct ofd_ring {
+	struct mutex lock;
+	char *buf;
+	size_t size;			/* a power of two */
+	u64 head, tail;			/* written under lock */
+	wait_queue_head_t rwait;	/* readers, for data */
+	wait_queue_head_t wwait;	/* writers, for room */
+	u32 id;				/* ofd_rec.ring */
+	bool overwrite;			/* drop the oldest records when full */
+	bool crc;			/* checksum records */
+	u64 seq;			/* of the next record */
+	u64 lost;			/* records dropped to make room */
+	u64 bad;			/* and for failing their checksum */
+	void *lz4_work;			/* LZ4_MEM_COMPRESS bytes, or NULL */
+	char *lz4_buf;			/* OFD_LZ4_BUF bytes, or NULL */
+	u64 lz4_in, lz4_out;		/* payload bytes, and what they took */
+	u64 lz4_ns, unlz4_ns;		/* spent compressing, decompressing */
+};
+
+/*
+ * Records up to this size are compressed: first copied whole into lz4_buf,
+ * then compressed into the rest of it. Bigger ones are kept as written.
+ */
+#define OFD_LZ4_MAX	(64 * 1024)
+#define OFD_LZ4_BUF	(OFD_LZ4_MAX + LZ4_COMPRESSBOUND(OFD_LZ4_MAX))
+#define ofd_ring_raw(r)	((r)->lz4_buf)
+#define ofd_ring_z(r)	((r)->lz4_buf + OFD_LZ4_MAX)
+
+static inline void ofd_ring_init(struct ofd_ring *r, void *buf, size_t size)
+{
+	mutex_init(&r->lock);
+	r->buf	= buf;
+	r->size	= size;
+	r->head	= r->tail = 0;
+	r->id	= 0;
+	r->overwrite = r->crc = false;
+	r->seq	= r->lost = r->bad = 0;
+	r->lz4_work = r->lz4_buf = NULL;
+	r->lz4_in = r->lz4_out = r->lz4_ns = r->unlz4_ns = 0;
+	init_waitqueue_head(&r->rwait);
+	init_waitqueue_head(&r->wwait);
+}
+
+static inline size_t ofd_ring_used(const struct ofd_ring *r)
+{
+	return READ_ONCE(r->head) - READ_ONCE(r->tail);
+}
+
+/*
+ * n bytes from ring position pos to the iterator, wrapping around the
+ * end; returns how many made it, short if the user buffer faulted
+ */
+static inline size_t ofd_ring_copy_out(struct ofd_ring *r, struct iov_iter *to,
+				       u64 pos, size_t n)
+{
+	size_t off = pos & (r->size - 1);
+	size_t first = n < r->size - off ? n : r->size - off;
+	size_t done;
+
+	done = copy_to_iter(r->buf + off, first, to);
+	if (done == first && n > first)
+		done += copy_to_iter(r->buf, n - first, to);
+	return done;
+}
+
+static inline size_t ofd_ring_copy_in(struct ofd_ring *r, u64 pos,
+				      struct iov_iter *from, size_t n)
+{
+	size_t off = pos & (r->size - 1);
+	size_t first = n < r->size - off ? n : r->size - off;
+	size_t done;
+
+	done = copy_from_iter(r->buf + off, first, from);
+	if (done == first && n > first)
+		done += copy_from_iter(r->buf, n - first, from);
+	return done;
+}
+
+/* Kernel memory in and out of the ring, wrapping around the end */
+static inline void ofd_ring_put(struct ofd_ring *r, u64 pos, const void *p,
+				size_t n)
+{
+	size_t off = pos & (r->size - 1);
+	size_t first = n < r->size - off ? n : r->size - off;
+
+	memcpy(r->buf + off, p, first);
+	memcpy(r->buf, (const char *) p + first, n - first);
+}
+
+static inline void ofd_ring_get(struct ofd_ring *r, u64 pos, void *p,
+				size_t n)
+{
+	size_t off = pos & (r->size - 1);
+	size_t first = n < r->size - off ? n : r->size - off;
+
+	memcpy(p, r->buf + off, first);
+	memcpy((char *) p + first, r->buf, n - first);
+}
+
+/*
+ * CRC32C of n bytes at ring position pos. crc32c() picks the fastest
+ * implementation the CPU has and saves the FPU itself if it needs it.
+ */
+static inline u32 ofd_ring_crc(struct ofd_ring *r, u64 pos, size_t n)
+{
+	size_t off = pos & (r->size - 1);
+	size_t first = n < r->size - off ? n : r->size - off;
+	u32 crc;
+
+	crc = crc32c(~0U, r->buf + off, first);
+	crc = crc32c(crc, r->buf, n - first);
+	return ~crc;
+}
+
+/* What the nonblock argument of the reads and writes below may be */
+#define OFD_RING_BLOCK		0	/* wait for the lock, and data or room */
+#define OFD_RING_NONBLOCK	1	/* for neither */
+#define OFD_RING_LOCK_ONLY	2	/* for the lock only */
+
+/*
+ * Returns with the lock held once cond holds, or -EAGAIN or -ERESTARTSYS
+ * without it. Nonblocking callers don't wait for the lock either, so
+ * IOCB_NOWAIT is honoured.
+ */
+#define ofd_ring_lock_when(r, wq, cond, nonblock)			\
+({									\
+	int __ret = 0;							\
+									\
+	for (;;) {							\
+		if ((nonblock) != OFD_RING_NONBLOCK)			\
+			mutex_lock(&(r)->lock);				\
+		else if (!mutex_trylock(&(r)->lock)) {			\
+			__ret = -EAGAIN;				\
+			break;						\
+		}							\
+		if (cond)						\
+			break;						\
+		mutex_unlock(&(r)->lock);				\
+		if (nonblock) {						\
+			__ret = -EAGAIN;				\
+			break;						\
+		}							\
+		if (wait_event_interruptible(wq, cond)) {		\
+			__ret = -ERESTARTSYS;				\
+			break;						\
+		}							\
+	}								\
+	__ret;								\
+})
+
+/* Takes as much as the iterator has room for, or as there is */
+static inline ssize_t ofd_ring_read(struct ofd_ring *r, struct iov_iter *to,
+				    int nonblock)
+{
+	size_t len = iov_iter_count(to);
+	size_t n;
+	int ret;
+
+	if (len == 0)
+		return 0;
+	ret = ofd_ring_lock_when(r, r->rwait, ofd_ring_used(r) != 0, nonblock);
+	if (ret)
+		return ret;
+
+	n = ofd_ring_used(r);
+	if (n > len)
+		n = len;
+	n = ofd_ring_copy_out(r, to, r->tail, n);
+	WRITE_ONCE(r->tail, r->tail + n);
+	mutex_unlock(&r->lock);
+	if (n == 0)
+		return -EFAULT;
+
+	wake_up_interruptible(&r->wwait);
+	return n;
+}
+
+/* Appends all the iterator has, or as much as there is room for */
+static inline ssize_t ofd_ring_write(struct ofd_ring *r, struct iov_iter *from,
+				     int nonblock)
+{
+	size_t len = iov_iter_count(from);
+	size_t n;
+	int ret;
+
+	if (len == 0)
+		return 0;
+	ret = ofd_ring_lock_when(r, r->wwait, ofd_ring_used(r) != r->size,
+				 nonblock);
+	if (ret)
+		return ret;
+
+	n = r->size - ofd_ring_used(r);
+	if (n > len)
+		n = len;
+	n = ofd_ring_copy_in(r, r->head, from, n);
+	WRITE_ONCE(r->head, r->head + n);
+	mutex_unlock(&r->lock);
+	if (n == 0)
+		return -EFAULT;
+
+	wake_up_interruptible(&r->rwait);
+	return n;
+}
+
+/*
+ * Records
+ */
+
+/* What a record's payload takes in the ring */
+static inline size_t ofd_rec_stored(const struct ofd_rec *rec)
+{
+	return rec->zlen ? rec->zlen : rec->len;
+}
+
+/*
+ * Whether the header at tail describes a record that is all there. Only
+ * the kernel writes the ring, but a header that has gone bad must not
+ * send a reader past head, or a copy off the end of the ring.
+ */
+static inline bool ofd_rec_valid(const struct ofd_ring *r,
+				 const struct ofd_rec *rec)
+{
+	size_t used = ofd_ring_used(r);
+
+	return used >= sizeof(*rec) && rec->len <= r->size &&
+		ofd_rec_stored(rec) <= used - sizeof(*rec);
+}
+
+/*
+ * After a bad header there is no telling where the next record starts:
+ * everything in the ring goes, counted as one bad record; lock held
+ */
+static inline void ofd_ring_corrupt(struct ofd_ring *r)
+{
+	WRITE_ONCE(r->tail, r->head);
+	r->bad++;
+}
+
+/* Drops the oldest records until there are n bytes free; lock held */
+static inline void ofd_ring_drop(struct ofd_ring *r, size_t n)
+{
+	struct ofd_rec rec;
+
+	while (r->size - ofd_ring_used(r) < n) {
+		ofd_ring_get(r, r->tail, &rec, sizeof(rec));
+		if (!ofd_rec_valid(r, &rec)) {
+			ofd_ring_corrupt(r);
+			break;
+		}
+		WRITE_ONCE(r->tail, r->tail + sizeof(rec) +
+			   ofd_rec_stored(&rec));
+		r->lost++;
+	}
+}
+
+#ifdef DD_HAVE_LZ4
+/*
+ * Takes rec->len bytes from the iterator into lz4_buf and compresses them,
+ * setting zlen if that saved anything and crc from the payload as written;
+ * lock held
+ */
+static inline int ofd_ring_lz4_in(struct ofd_ring *r, struct iov_iter *from,
+				  struct ofd_rec *rec)
+{
+	u64 t0;
+	int z;
+
+	if (copy_from_iter(ofd_ring_raw(r), rec->len, from) != rec->len)
+		return -EFAULT;
+	t0 = local_clock();
+	z = LZ4_compress_default(ofd_ring_raw(r), ofd_ring_z(r), rec->len,
+				 LZ4_COMPRESSBOUND(OFD_LZ4_MAX), r->lz4_work);
+	r->lz4_ns += local_clock() - t0;
+	rec->zlen = z > 0 && z < rec->len ? z : 0;
+	r->lz4_in += rec->len;
+	r->lz4_out += ofd_rec_stored(rec);
+	if (r->crc)
+		rec->crc = ~crc32c(~0U, ofd_ring_raw(r), rec->len);
+	return 0;
+}
+
+/*
+ * Decompresses the record at tail into lz4_buf, and checks it came out
+ * whole and, with crc, as written; lock held. A header that doesn't fit
+ * in lz4_buf, or that claims compression on a ring without it, was never
+ * written so.
+ */
+static inline int ofd_ring_lz4_out(struct ofd_ring *r,
+				   const struct ofd_rec *rec)
+{
+	u64 t0;
+	int n;
+
+	if (!r->lz4_buf || rec->len > OFD_LZ4_MAX ||
+	    rec->zlen > LZ4_COMPRESSBOUND(rec->len))
+		return -EBADMSG;
+	ofd_ring_get(r, r->tail + sizeof(*rec), ofd_ring_z(r), rec->zlen);
+	t0 = local_clock();
+	n = LZ4_decompress_safe(ofd_ring_z(r), ofd_ring_raw(r), rec->zlen,
+				rec->len);
+	r->unlz4_ns += local_clock() - t0;
+	if (n != rec->len)
+		return -EBADMSG;
+	if (r->crc && ~crc32c(~0U, ofd_ring_raw(r), rec->len) != rec->crc)
+		return -EBADMSG;
+	return 0;
+}
+#else
+/* No ring gets lz4_buf without LZ4, so no record is compressed */
+static inline int ofd_ring_lz4_in(struct ofd_ring *r, struct iov_iter *from,
+				  struct ofd_rec *rec)
+{
+	return -EOPNOTSUPP;
+}
+
+static inline int ofd_ring_lz4_out(struct ofd_ring *r,
+				   const struct ofd_rec *rec)
+{
+	return -EBADMSG;
+}
+#endif
+
+/*
+ * Adds what the iterator has as one record, once there is room for all of
+ * it as written; a record that could never fit is refused with -EMSGSIZE
+ */
+static inline ssize_t ofd_ring_write_rec(struct ofd_ring *r,
+					 struct iov_iter *from, int nonblock)
+{
+	struct ofd_rec rec = { .len = iov_iter_count(from), .ring = r->id };
+	size_t need = sizeof(rec) + rec.len;
+	int ret;
+
+	if (rec.len == 0)
+		return 0;
+	if (need > r->size || rec.len != iov_iter_count(from))
+		return -EMSGSIZE;
+	ret = ofd_ring_lock_when(r, r->wwait, r->overwrite ||
+				 r->size - ofd_ring_used(r) >= need, nonblock);
+	if (ret)
+		return ret;
+
+	if (r->lz4_buf && rec.len <= OFD_LZ4_MAX) {
+		ret = ofd_ring_lz4_in(r, from, &rec);
+		if (ret) {
+			mutex_unlock(&r->lock);
+			return ret;
+		}
+		need = sizeof(rec) + ofd_rec_stored(&rec);
+		if (r->overwrite)
+			ofd_ring_drop(r, need);
+		ofd_ring_put(r, r->head + sizeof(rec), rec.zlen ?
+			     ofd_ring_z(r) : ofd_ring_raw(r),
+			     ofd_rec_stored(&rec));
+	} else {
+		/*
+		 * The payload goes over the records dropped for it, so
+		 * none go for a write whose buffer can't be read. Only a
+		 * buffer unmapped under us now fails after the drop.
+		 */
+		if (r->overwrite && r->size - ofd_ring_used(r) < need) {
+			if (fault_in_iov_iter_readable(from, rec.len)) {
+				mutex_unlock(&r->lock);
+				return -EFAULT;
+			}
+			ofd_ring_drop(r, need);
+		}
+		/* head only moves past a record once all of it is in */
+		if (ofd_ring_copy_in(r, r->head + sizeof(rec), from,
+				     rec.len) != rec.len) {
+			mutex_unlock(&r->lock);
+			return -EFAULT;
+		}
+		if (r->crc)
+			rec.crc = ofd_ring_crc(r, r->head + sizeof(rec),
+					       rec.len);
+	}
+	rec.seq = r->seq;
+	ofd_ring_put(r, r->head, &rec, sizeof(rec));
+	WRITE_ONCE(r->head, r->head + need);
+	r->seq++;
+	mutex_unlock(&r->lock);
+
+	wake_up_interruptible(&r->rwait);
+	return rec.len;
+}
+
+/*
+ * Takes the oldest record's payload, if the iterator has room for it.
+ * With batch, takes as many whole records as fit instead, each with its
+ * struct ofd_rec, and counts them in *batch. A record that fails its
+ * checksum, or to decompress, ends the batch; taken first, it is dropped
+ * with -EBADMSG. A header that makes no sense empties the ring the same
+ * way.
+ */
+static inline ssize_t ofd_ring_read_rec(struct ofd_ring *r,
+					struct iov_iter *to, int nonblock,
+					unsigned int *batch)
+{
+	size_t hdr = batch ? sizeof(struct ofd_rec) : 0;
+	struct ofd_rec rec;
+	ssize_t done = 0;
+	unsigned int nr = 0;
+	size_t n;
+	int ret;
+
+	ret = ofd_ring_lock_when(r, r->rwait, ofd_ring_used(r) != 0, nonblock);
+	if (ret)
+		return ret;
+
+	while (r->tail != r->head) {
+		ofd_ring_get(r, r->tail, &rec, sizeof(rec));
+		if (!ofd_rec_valid(r, &rec)) {
+			ofd_ring_corrupt(r);
+			if (!nr)
+				done = -EBADMSG;
+			break;
+		}
+		if (hdr + rec.len > iov_iter_count(to)) {
+			if (!nr)
+				done = -EMSGSIZE;
+			break;
+		}
+		if (rec.zlen)
+			ret = ofd_ring_lz4_out(r, &rec);
+		else if (r->crc && ofd_ring_crc(r, r->tail + sizeof(rec),
+						rec.len) != rec.crc)
+			ret = -EBADMSG;
+		if (ret) {
+			if (!nr) {
+				WRITE_ONCE(r->tail, r->tail + sizeof(rec) +
+					   ofd_rec_stored(&rec));
+				r->bad++;
+				done = -EBADMSG;
+			}
+			break;
+		}
+		/* a record that faulted stays for the next try */
+		if (copy_to_iter(&rec, hdr, to) != hdr) {
+			if (!nr)
+				done = -EFAULT;
+			break;
+		}
+		n = rec.zlen ? copy_to_iter(ofd_ring_raw(r), rec.len, to) :
+			ofd_ring_copy_out(r, to, r->tail + sizeof(rec), rec.len);
+		if (n != rec.len) {
+			if (!nr)
+				done = -EFAULT;
+			break;
+		}
+		WRITE_ONCE(r->tail, r->tail + sizeof(rec) +
+			   ofd_rec_stored(&rec));
+		done += hdr + rec.len;
+		nr++;
+		if (!batch)
+			break;
+	}
+	mutex_unlock(&r->lock);
+
+	if (batch)
+		*batch = nr;
+	if (nr || done == -EBADMSG)
+		wake_up_interruptible(&r->wwait);
+	return done;
+}
+
+#endif /* _OFD_RING_H */
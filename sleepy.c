@@ -3,7 +3,18 @@
  *
  * You have to write before you can read ;-)
  *
- * Test by having read and write calls in separate terminal windows.
+ * Test by having read and write calls in separate terminal windows, on
+ * /dev/sleepy0, or time round trips between two minors with bench/pingpong.
+ * Each of the `num_devices` minors has readers of its own. A read with
+ * O_NONBLOCK takes a pending wake or fails with -EAGAIN. How long readers
+ * slept is in /sys/kernel/debug/dd/sleepy<n>, along with how many requests
+ * came from CPUs off the minor's NUMA node (see `node`).
+ *
+ * Readers may spin for a while before they sleep, for as long as recent
+ * wakes say one is likely to come (see dd_spin.h), up to `spin_ns`, or
+ * /sys/class/dd/sleepy<n>/spin_ns per minor. The debugfs file counts the
+ * reads that spinning saved from sleeping as "spins", the others as
+ * "waits".
  */
 
 #include <linux/module.h>
@@ -11,61 +22,158 @@
 
 #include <linux/sched.h>	/* current and everything */
 #include <linux/kernel.h>
-#include <linux/fs.h>		/* register_chrdev();	*/
+#include <linux/fs.h>
 #include <linux/types.h>
 #include <linux/wait.h>		/* sleep-related stuff	*/
+#include <linux/cache.h>
+#include <linux/mm.h>		/* page_to_nid() */
+#include <linux/numa.h>
+
+#include "dd_core.h"
+#include "dd_param.h"
+#include "dd_spin.h"
+#include "sleepy_core.h"	/* the sleep/wake logic proper */
 
 MODULE_LICENSE("GPL");
 
-static int sleepy_major = 0;
-static DECLARE_WAIT_QUEUE_HEAD(wq);
-static int flag		= 0;
+static int num_devices = 1;	/* minors, each with readers of its own */
+module_param(num_devices, int, 0444);
+
+static int node = NUMA_NO_NODE;	/* to allocate the minors on */
+module_param(node, int, 0444);
+
+static unsigned int spin_ns;	/* most a reader spins before sleeping */
+module_param(spin_ns, uint, 0444);
+
+/* One per minor, on cache lines of its own */
+struct sleepy_dev {
+	struct sleepy_core core;
+	int nid;			/* where this is */
+} ____cacheline_aligned_in_smp;
+
+/* 1: a write wakes a single reader; 0: all of them, as the book has it */
+static int wake_one = 0;
+
+DD_PARAM(wake_one, int, 0, 1, NULL);
+
+static int sleepy_open(struct inode *inode, struct file *filp)
+{
+	filp->private_data = dd_chrdev_priv(inode);
+	dd_stat_inc(dd_file_stats(filp), DD_OPENS);
+	return 0;
+}
 
 ssize_t sleepy_read(struct file *filp, char __user *buf, size_t count,
 		    loff_t *pos)
 {
-	printk(KERN_DEBUG "process %i (%s) going to sleep\n", current->pid,
+	struct sleepy_dev *sd = filp->private_data;
+	struct dd_stats __percpu *st = dd_file_stats(filp);
+	u64 t0 = ktime_get_ns();
+	int ret;
+
+	dd_stat_remote(st, sd->nid);
+	if (filp->f_flags & O_NONBLOCK) {
+		ret = sleepy_core_trywait(&sd->core);
+		dd_stat_io(st, DD_READS, ret, t0);
+		return ret;
+	}
+
+	pr_debug("process %i (%s) going to sleep\n", current->pid,
 			current->comm);
-	wait_event_interruptible(wq, flag != 0);
-	flag = 0;
-	printk(KERN_DEBUG "awoken %i (%s)\n", current->pid, current->comm);
+	ret = sleepy_core_wait(&sd->core, READ_ONCE(wake_one));
+	dd_stat_inc(st, ret > 0 ? DD_SPINS : DD_WAITS);
+	if (ret > 0)
+		ret = 0;
+	dd_stat_io(st, DD_READS, ret, t0);
+	if (ret)
+		return ret;
+	pr_debug("awoken %i (%s)\n", current->pid, current->comm);
 	return 0;	/* EOF */
 }
 
 ssize_t sleepy_write(struct file *filp, const char __user *buf, size_t count,
 		     loff_t *pos)
 {
-	printk(KERN_DEBUG "process %i (%s) awakening the readers...\n",
+	struct sleepy_dev *sd = filp->private_data;
+
+	struct dd_stats __percpu *st = dd_file_stats(filp);
+	u64 t0 = ktime_get_ns();
+
+	pr_debug("process %i (%s) awakening the readers...\n",
 			current->pid, current->comm);
-	flag = 1;
-	wake_up_interruptible(&wq);
+	dd_stat_remote(st, sd->nid);
+	sleepy_core_wake(&sd->core);
+	dd_stat_inc(st, DD_WAKEUPS);
+	dd_stat_io(st, DD_WRITES, count, t0);
 	return count;		/* succeed to avoid retrial */
 }
 
 struct file_operations sleepy_fops = {
 	.owner	= THIS_MODULE,
+	.open	= sleepy_open,
 	.read	= sleepy_read,
 	.write	= sleepy_write
 };
 
-int sleepy_init(void)
+/* /sys/class/dd/sleepy<n>/spin_ns */
+static ssize_t spin_ns_show(struct device *dev, struct device_attribute *attr,
+			    char *buf)
+{
+	struct sleepy_dev *sd = dev_get_drvdata(dev);
+
+	return dd_spin_show(&sd->core.spin, buf);
+}
+
+static ssize_t spin_ns_store(struct device *dev,
+			     struct device_attribute *attr, const char *buf,
+			     size_t count)
+{
+	struct sleepy_dev *sd = dev_get_drvdata(dev);
+
+	return dd_spin_store(&sd->core.spin, buf, count);
+}
+static DEVICE_ATTR_RW(spin_ns);
+
+static struct attribute *sleepy_attrs[] = {
+	&dev_attr_spin_ns.attr,
+	NULL
+};
+ATTRIBUTE_GROUPS(sleepy);
+
+static int sleepy_setup(void *priv, int minor)
 {
-	int result;
+	struct sleepy_dev *sd = priv;
 
+	sd->nid = page_to_nid(virt_to_page(sd));
+	sleepy_core_init(&sd->core);
+	dd_spin_init(&sd->core.spin, spin_ns);
+	return 0;
+}
+
+static struct dd_chrdev sleepy_chrdev = {
+	.name		= "sleepy",
+	.node		= "sleepy%d",
+	.fops		= &sleepy_fops,
+	.groups		= sleepy_groups,
+	.priv_size	= sizeof(struct sleepy_dev),
+	.numa_node	= &node,
+	.setup		= sleepy_setup
+};
+
+int sleepy_init(void)
+{
 	/*
-	 * Register your major, and accept a dynamic number
+	 * Register a dynamic major, and a /dev/sleepy<n> node per minor
 	 */
-	result = register_chrdev(sleepy_major, "sleepy", &sleepy_fops);
-	if (result < 0)
-		return result;
-	if (sleepy_major == 0)
-		sleepy_major = result;	/* dynamic */
-	return 0;
+	if (spin_ns > DD_SPIN_MAX_NS)
+		return -EINVAL;
+	sleepy_chrdev.count = num_devices;
+	return dd_chrdev_register(&sleepy_chrdev);
 }
 
 void sleepy_cleanup(void)
 {
-	unregister_chrdev(sleepy_major, "sleepy");
+	dd_chrdev_unregister(&sleepy_chrdev);
 }
 
 module_init(sleepy_init);
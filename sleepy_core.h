@@ -0,0 +1,78 @@
+/*
+ * sleepy_core.h -- the sleep/wake logic of sleepy, kept free of driver
+ * plumbing so it builds in user space too (see userbench/kshim.h)
+ */
+
+#ifndef _SLEEPY_CORE_H
+#define _SLEEPY_CORE_H
+
+#ifdef __KERNEL__
+#include <linux/wait.h>		/* sleep-related stuff */
+#include <linux/sched.h>
+#else
+#include "userbench/kshim.h"
+#endif
+
+#include "dd_spin.h"
+
+struct sleepy_core {
+	wait_queue_head_t wq;
+	int flag;		/* set by a writer, taken by the reader it wakes */
+	struct dd_spin spin;	/* how long readers poll before sleeping */
+};
+
+static inline void sleepy_core_init(struct sleepy_core *sc)
+{
+	init_waitqueue_head(&sc->wq);
+	sc->flag = 0;
+	dd_spin_init(&sc->spin, 0);
+}
+
+/*
+ * Whoever clears the flag has the wake: one write lets one reader through,
+ * spinning or sleeping
+ */
+static inline bool sleepy_core_take(struct sleepy_core *sc)
+{
+	return READ_ONCE(sc->flag) && xchg(&sc->flag, 0);
+}
+
+/*
+ * Returns 0 once woken, 1 if the wake came while still spinning, or
+ * -ERESTARTSYS if a signal came first. Exclusive waiters are woken one per
+ * wake; the others are all woken, and those that find the flag already
+ * taken go back to sleep.
+ */
+static inline int sleepy_core_wait(struct sleepy_core *sc, int exclusive)
+{
+	u64 t0 = dd_spin_start(&sc->spin);
+	int ret;
+
+	if (dd_spin_until(&sc->spin, t0, sleepy_core_take(sc))) {
+		dd_spin_learn(&sc->spin, t0);
+		return 1;
+	}
+	if (exclusive)
+		ret = wait_event_interruptible_exclusive(sc->wq,
+							 sleepy_core_take(sc));
+	else
+		ret = wait_event_interruptible(sc->wq, sleepy_core_take(sc));
+	if (ret)
+		return -ERESTARTSYS;
+	dd_spin_learn(&sc->spin, t0);
+	return 0;
+}
+
+/* Takes a pending wake without sleeping, or returns -EAGAIN if none is */
+static inline int sleepy_core_trywait(struct sleepy_core *sc)
+{
+	return sleepy_core_take(sc) ? 0 : -EAGAIN;
+}
+
+static inline void sleepy_core_wake(struct sleepy_core *sc)
+{
+	sc->flag = 1;
+	wake_up_interruptible(&sc->wq);
+}
+
+#endif /* _SLEEPY_CORE_H */
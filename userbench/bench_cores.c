@@ -0,0 +1,244 @@
+/*
+ * bench_cores.c -- microbenchmarks of the ofd, sleepy and kertimer cores
+ */
+
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <stdlib.h>
+
+#include "../ofd_core.h"
+#include "../ofd_ring.h"
+#include "../sleepy_core.h"
+#include "../kertimer_core.h"
+#include "userbench.h"
+
+/*
+ * ofd
+ */
+static void BM_ofd_write_1(struct ub_state *st)
+{
+	struct ofd_store store;
+	struct iov_iter it;
+	char c = 'x';
+
+	ofd_store_init(&store);
+	while (ub_keep_running(st)) {
+		shim_iov_iter(&it, &c, 1);
+		UB_CHECK(ofd_store_write(&store, &it) == 1);
+	}
+	ub_set_bytes(st, st->iterations);
+}
+BENCHMARK(BM_ofd_write_1);
+
+static void BM_ofd_write_read(struct ub_state *st)
+{
+	struct ofd_store store;
+	struct iov_iter it;
+	char c = 'x';
+	loff_t off;
+
+	ofd_store_init(&store);
+	while (ub_keep_running(st)) {
+		off = 0;
+		shim_iov_iter(&it, &c, 1);
+		UB_CHECK(ofd_store_write(&store, &it) == 1);
+		shim_iov_iter(&it, &c, 1);
+		UB_CHECK(ofd_store_read(&store, &it, &off) == 1);
+	}
+	ub_set_bytes(st, st->iterations * 2);
+}
+BENCHMARK(BM_ofd_write_read);
+
+/* ring mode: a page in, a page out, through a 64 KiB ring */
+static void BM_ofd_ring_write_read(struct ub_state *st)
+{
+	static char ring[65536], page[4096];
+	struct ofd_ring r;
+	struct iov_iter it;
+
+	ofd_ring_init(&r, ring, sizeof(ring));
+	while (ub_keep_running(st)) {
+		shim_iov_iter(&it, page, sizeof(page));
+		UB_CHECK(ofd_ring_write(&r, &it, 1) == sizeof(page));
+		shim_iov_iter(&it, page, sizeof(page));
+		UB_CHECK(ofd_ring_read(&r, &it, 1) == sizeof(page));
+	}
+	ub_set_bytes(st, st->iterations * 2 * sizeof(page));
+}
+BENCHMARK(BM_ofd_ring_write_read);
+
+/* record mode: 64 byte records, one at a time and then drained in a batch */
+static void ofd_ring_records(struct ub_state *st, bool crc)
+{
+	static char ring[65536], rec[64];
+	static char batch[16 * (sizeof(struct ofd_rec) + sizeof(rec))];
+	struct ofd_ring r;
+	struct iov_iter it;
+	unsigned int nr;
+	int i;
+
+	ofd_ring_init(&r, ring, sizeof(ring));
+	r.crc = crc;
+	while (ub_keep_running(st)) {
+		for (i = 0; i < 16; i++) {
+			shim_iov_iter(&it, rec, sizeof(rec));
+			UB_CHECK(ofd_ring_write_rec(&r, &it, 1) == sizeof(rec));
+		}
+		shim_iov_iter(&it, batch, sizeof(batch));
+		UB_CHECK(ofd_ring_read_rec(&r, &it, 1, &nr) == sizeof(batch));
+		UB_CHECK(nr == 16);
+	}
+	ub_set_items(st, st->iterations * 16);
+}
+
+static void BM_ofd_ring_records(struct ub_state *st)
+{
+	ofd_ring_records(st, false);
+}
+BENCHMARK(BM_ofd_ring_records);
+
+/* the same, checksummed going in and checked coming out */
+static void BM_ofd_ring_records_crc(struct ub_state *st)
+{
+	ofd_ring_records(st, true);
+}
+BENCHMARK(BM_ofd_ring_records_crc);
+
+/* flight recorder: 64 byte records into a ring that is always full */
+static void BM_ofd_ring_overwrite(struct ub_state *st)
+{
+	static char ring[65536], rec[64];
+	struct ofd_ring r;
+	struct iov_iter it;
+
+	ofd_ring_init(&r, ring, sizeof(ring));
+	r.overwrite = true;
+	while (ub_keep_running(st)) {
+		shim_iov_iter(&it, rec, sizeof(rec));
+		UB_CHECK(ofd_ring_write_rec(&r, &it, 1) == sizeof(rec));
+	}
+	ub_set_items(st, st->iterations);
+}
+BENCHMARK(BM_ofd_ring_overwrite);
+
+/*
+ * sleepy
+ */
+
+/* the path taken when the flag is already up: no sleeping */
+static void BM_sleepy_wake_wait(struct ub_state *st)
+{
+	struct sleepy_core sc;
+
+	sleepy_core_init(&sc);
+	while (ub_keep_running(st)) {
+		sleepy_core_wake(&sc);
+		UB_CHECK(sleepy_core_wait(&sc, 0) >= 0);
+	}
+	ub_set_items(st, st->iterations);
+}
+BENCHMARK(BM_sleepy_wake_wait);
+
+/* a token bounced between two threads through two sleepy cores */
+struct sleepy_pair {
+	struct sleepy_core ping, pong;
+	uint64_t rounds;
+};
+
+static void *sleepy_ponger(void *arg)
+{
+	struct sleepy_pair *p = arg;
+	uint64_t i;
+
+	for (i = 0; i < p->rounds; i++) {
+		UB_CHECK(sleepy_core_wait(&p->ping, 0) >= 0);
+		sleepy_core_wake(&p->pong);
+	}
+	return NULL;
+}
+
+static void sleepy_pingpong(struct ub_state *st, unsigned int spin_ns)
+{
+	struct sleepy_pair p;
+	pthread_t t;
+
+	sleepy_core_init(&p.ping);
+	sleepy_core_init(&p.pong);
+	dd_spin_init(&p.ping.spin, spin_ns);
+	dd_spin_init(&p.pong.spin, spin_ns);
+	p.rounds = st->iterations;
+	pthread_create(&t, NULL, sleepy_ponger, &p);
+	while (ub_keep_running(st)) {
+		sleepy_core_wake(&p.ping);
+		UB_CHECK(sleepy_core_wait(&p.pong, 0) >= 0);
+	}
+	pthread_join(t, NULL);
+	ub_set_items(st, st->iterations);
+}
+
+static void BM_sleepy_pingpong(struct ub_state *st)
+{
+	sleepy_pingpong(st, 0);
+}
+BENCHMARK(BM_sleepy_pingpong);
+
+/* the same, with both sides spinning up to 20 us before they sleep */
+static void BM_sleepy_pingpong_spin(struct ub_state *st)
+{
+	sleepy_pingpong(st, 20000);
+}
+BENCHMARK(BM_sleepy_pingpong_spin);
+
+/*
+ * kertimer
+ */
+static void kt_bench_fn(struct timer_list *t)
+{
+}
+
+/* what every read of /dev/kertimer does to a pending timer */
+static void BM_kertimer_rearm(struct ub_state *st)
+{
+	struct kt_core kt;
+
+	kt_core_init(&kt, kt_bench_fn);
+	while (ub_keep_running(st))
+		kt_core_arm(&kt, HZ);
+	kt_core_cancel(&kt);
+	ub_set_items(st, st->iterations);
+}
+BENCHMARK(BM_kertimer_rearm);
+
+static void BM_kertimer_arm_cancel(struct ub_state *st)
+{
+	struct kt_core kt;
+
+	kt_core_init(&kt, kt_bench_fn);
+	while (ub_keep_running(st)) {
+		kt_core_arm(&kt, HZ);
+		UB_CHECK(kt_core_cancel(&kt) == 1);
+	}
+	ub_set_items(st, st->iterations);
+}
+BENCHMARK(BM_kertimer_arm_cancel);
+
+/* arming among many other pending timers */
+static void BM_kertimer_arm_1k_pending(struct ub_state *st)
+{
+	struct kt_core *kts;
+	int i;
+
+	kts = calloc(1024, sizeof(*kts));
+	for (i = 0; i < 1024; i++) {
+		kt_core_init(&kts[i], kt_bench_fn);
+		kt_core_arm(&kts[i], HZ + i);
+	}
+	i = 0;
+	while (ub_keep_running(st))
+		kt_core_arm(&kts[i++ & 1023], HZ);
+	for (i = 0; i < 1024; i++)
+		kt_core_cancel(&kts[i]);
+	free(kts);
+	ub_set_items(st, st->iterations);
+}
+BENCHMARK(BM_kertimer_arm_1k_pending);
@@ -0,0 +1,178 @@
+/*
+ * check_cores.c -- checks of the ofd ring's edge cases, run by
+ * userbench --check
+ */
+
+#define _GNU_SOURCE
+#include <string.h>
+
+#include "../ofd_ring.h"
+#include "userbench.h"
+
+#define RING_SIZE	256
+
+static ssize_t put_rec(struct ofd_ring *r, void *p, size_t n)
+{
+	struct iov_iter it;
+
+	shim_iov_iter(&it, p, n);
+	return ofd_ring_write_rec(r, &it, OFD_RING_NONBLOCK);
+}
+
+static ssize_t get_rec(struct ofd_ring *r, void *p, size_t n,
+		       unsigned int *batch)
+{
+	struct iov_iter it;
+
+	shim_iov_iter(&it, p, n);
+	return ofd_ring_read_rec(r, &it, OFD_RING_NONBLOCK, batch);
+}
+
+/* Bytes and records that straddle the end of the ring come back whole */
+static void CHECK_ofd_ring_wrap(void)
+{
+	static char ring[RING_SIZE];
+	char in[200], out[200];
+	struct ofd_ring r;
+	struct iov_iter it;
+	int i, j;
+
+	ofd_ring_init(&r, ring, sizeof(ring));
+	for (i = 0; i < 4; i++) {
+		memset(in, 'a' + i, sizeof(in));
+		shim_iov_iter(&it, in, sizeof(in));
+		UB_CHECK(ofd_ring_write(&r, &it, OFD_RING_NONBLOCK) ==
+			 sizeof(in));
+		shim_iov_iter(&it, out, sizeof(out));
+		UB_CHECK(ofd_ring_read(&r, &it, OFD_RING_NONBLOCK) ==
+			 sizeof(out));
+		UB_CHECK(!memcmp(in, out, sizeof(in)));
+	}
+
+	/* a 24 byte header and 100 bytes: each lands somewhere new */
+	ofd_ring_init(&r, ring, sizeof(ring));
+	r.crc = true;
+	for (i = 0; i < 10; i++) {
+		for (j = 0; j < 100; j++)
+			in[j] = i + j;
+		UB_CHECK(put_rec(&r, in, 100) == 100);
+		UB_CHECK(get_rec(&r, out, sizeof(out), NULL) == 100);
+		UB_CHECK(!memcmp(in, out, 100));
+	}
+	UB_CHECK(r.seq == 10 && r.bad == 0 && ofd_ring_used(&r) == 0);
+}
+UB_TEST(CHECK_ofd_ring_wrap);
+
+/* Records too big for the ring, or for the reader, are refused */
+static void CHECK_ofd_ring_emsgsize(void)
+{
+	static char ring[RING_SIZE];
+	char in[RING_SIZE], out[RING_SIZE];
+	struct ofd_ring r;
+	unsigned int nr;
+
+	memset(in, 'x', sizeof(in));
+	ofd_ring_init(&r, ring, sizeof(ring));
+	UB_CHECK(put_rec(&r, in, RING_SIZE - sizeof(struct ofd_rec) + 1) ==
+		 -EMSGSIZE);
+	UB_CHECK(ofd_ring_used(&r) == 0 && r.seq == 0);
+
+	UB_CHECK(put_rec(&r, in, 64) == 64);
+	UB_CHECK(get_rec(&r, out, 63, NULL) == -EMSGSIZE);
+	UB_CHECK(get_rec(&r, out, sizeof(struct ofd_rec) + 63, &nr) ==
+		 -EMSGSIZE);
+	UB_CHECK(nr == 0);
+	/* and the record is still there for a reader with room */
+	UB_CHECK(get_rec(&r, out, 64, NULL) == 64);
+	UB_CHECK(ofd_ring_used(&r) == 0);
+}
+UB_TEST(CHECK_ofd_ring_emsgsize);
+
+/* The gaps a reader sees in seq add up to what the ring says it lost */
+static void CHECK_ofd_ring_overwrite_lost(void)
+{
+	static char ring[RING_SIZE];
+	char in[40], out[sizeof(struct ofd_rec) + sizeof(in)];
+	struct ofd_rec *rec = (struct ofd_rec *) out;
+	u64 next = 0, lost = 0;
+	struct ofd_ring r;
+	unsigned int nr;
+	int i;
+
+	ofd_ring_init(&r, ring, sizeof(ring));
+	r.overwrite = true;
+	for (i = 0; i < 20; i++) {
+		memset(in, i, sizeof(in));
+		UB_CHECK(put_rec(&r, in, sizeof(in)) == sizeof(in));
+	}
+	UB_CHECK(r.lost > 0);
+
+	while (ofd_ring_used(&r)) {
+		UB_CHECK(get_rec(&r, out, sizeof(out), &nr) == sizeof(out));
+		UB_CHECK(nr == 1 && rec->len == sizeof(in));
+		UB_CHECK(rec->seq >= next);
+		UB_CHECK((unsigned char) out[sizeof(*rec)] == rec->seq);
+		lost += rec->seq - next;
+		next = rec->seq + 1;
+	}
+	UB_CHECK(next == 20);
+	UB_CHECK(lost == r.lost);
+}
+UB_TEST(CHECK_ofd_ring_overwrite_lost);
+
+/* A payload changed in the ring fails its checksum, alone */
+static void CHECK_ofd_ring_crc(void)
+{
+	static char ring[RING_SIZE];
+	char in[64], out[64];
+	struct ofd_ring r;
+
+	ofd_ring_init(&r, ring, sizeof(ring));
+	r.crc = true;
+	memset(in, 'x', sizeof(in));
+	UB_CHECK(put_rec(&r, in, sizeof(in)) == sizeof(in));
+	UB_CHECK(put_rec(&r, in, sizeof(in)) == sizeof(in));
+
+	ring[sizeof(struct ofd_rec) + 10] ^= 1;
+	UB_CHECK(get_rec(&r, out, sizeof(out), NULL) == -EBADMSG);
+	UB_CHECK(r.bad == 1);
+	UB_CHECK(get_rec(&r, out, sizeof(out), NULL) == sizeof(out));
+	UB_CHECK(!memcmp(in, out, sizeof(in)));
+	UB_CHECK(ofd_ring_used(&r) == 0);
+}
+UB_TEST(CHECK_ofd_ring_crc);
+
+/*
+ * A header claiming more than the ring holds empties it, both for a
+ * reader and for a writer making room
+ */
+static void CHECK_ofd_ring_bad_header(void)
+{
+	static char ring[RING_SIZE];
+	char in[64], out[RING_SIZE];
+	struct ofd_ring r;
+	struct ofd_rec rec;
+
+	memset(in, 'x', sizeof(in));
+	ofd_ring_init(&r, ring, sizeof(ring));
+	UB_CHECK(put_rec(&r, in, sizeof(in)) == sizeof(in));
+	UB_CHECK(put_rec(&r, in, sizeof(in)) == sizeof(in));
+	ofd_ring_get(&r, r.tail, &rec, sizeof(rec));
+	rec.len = 200;
+	ofd_ring_put(&r, r.tail, &rec, sizeof(rec));
+	UB_CHECK(get_rec(&r, out, sizeof(out), NULL) == -EBADMSG);
+	UB_CHECK(r.bad == 1 && ofd_ring_used(&r) == 0);
+
+	ofd_ring_init(&r, ring, sizeof(ring));
+	r.overwrite = true;
+	UB_CHECK(put_rec(&r, in, sizeof(in)) == sizeof(in));
+	UB_CHECK(put_rec(&r, in, sizeof(in)) == sizeof(in));
+	ofd_ring_get(&r, r.tail, &rec, sizeof(rec));
+	rec.len = RING_SIZE + 1;
+	ofd_ring_put(&r, r.tail, &rec, sizeof(rec));
+	UB_CHECK(put_rec(&r, in, sizeof(in)) == sizeof(in));
+	UB_CHECK(r.bad == 1 && r.lost == 0);
+	UB_CHECK(ofd_ring_used(&r) == sizeof(rec) + sizeof(in));
+	UB_CHECK(get_rec(&r, out, sizeof(out), NULL) == sizeof(in));
+}
+UB_TEST(CHECK_ofd_ring_bad_header);
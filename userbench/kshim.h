@@ -0,0 +1,311 @@
+/*
+ * kshim.h -- just enough of the kernel API to build the driver cores
+ * (ofd_core.h, ofd_ring.h, sleepy_core.h, kertimer_core.h, dd_spin.h) in
+ * user space
+ *
+ * Spinlocks are pthread spinlocks, mutexes pthread mutexes, wait queues a
+ * mutex and a condition variable, jiffies and local_clock() are derived
+ * from CLOCK_MONOTONIC and user copies are plain memcpy(), as are copies
+ * to and from an iov_iter, which is a single buffer set up with
+ * shim_iov_iter(). Timers never fire on their own: shim_run_timers() runs
+ * the expired ones in the caller's context.
+ */
+
+#ifndef _KSHIM_H
+#define _KSHIM_H
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <time.h>
+
+typedef uint8_t		u8;
+typedef uint16_t	u16;
+typedef uint32_t	u32;
+typedef uint64_t	u64;
+typedef int64_t		s64;
+
+#define U64_MAX		UINT64_MAX
+
+#define __user
+#define likely(x)	__builtin_expect(!!(x), 1)
+#define unlikely(x)	__builtin_expect(!!(x), 0)
+
+#define min(a, b)		((a) < (b) ? (a) : (b))
+#define min_t(type, a, b)	min((type) (a), (type) (b))
+
+#define READ_ONCE(x)		(*(const volatile __typeof__(x) *) &(x))
+#define WRITE_ONCE(x, val)	(*(volatile __typeof__(x) *) &(x) = (val))
+#define xchg(p, val)		__atomic_exchange_n(p, val, __ATOMIC_SEQ_CST)
+
+#define ERESTARTSYS	512
+
+#define KERN_INFO	""
+#define KERN_DEBUG	""
+#define printk(...)	((void) 0)
+#define pr_info(...)	((void) 0)
+#define pr_debug(...)	((void) 0)
+
+/*
+ * Scheduling: user space can't tell whether anything is waiting for the
+ * CPU, so a spinner asking gives it up for a moment instead
+ */
+#if defined(__x86_64__) || defined(__i386__)
+#define cpu_relax()		__builtin_ia32_pause()
+#else
+#define cpu_relax()		__asm__ __volatile__("" ::: "memory")
+#endif
+#define need_resched()		(sched_yield(), 0)
+
+/*
+ * Locking
+ */
+typedef pthread_spinlock_t spinlock_t;
+
+#define spin_lock_init(l)	pthread_spin_init(l, PTHREAD_PROCESS_PRIVATE)
+#define spin_lock(l)		pthread_spin_lock(l)
+#define spin_unlock(l)		pthread_spin_unlock(l)
+#define spin_lock_irqsave(l, flags)					\
+	do { (flags) = 0; pthread_spin_lock(l); } while (0)
+#define spin_unlock_irqrestore(l, flags)				\
+	do { (void) (flags); pthread_spin_unlock(l); } while (0)
+
+struct mutex {
+	pthread_mutex_t m;
+};
+
+#define mutex_init(l)		pthread_mutex_init(&(l)->m, NULL)
+#define mutex_lock(l)		pthread_mutex_lock(&(l)->m)
+#define mutex_trylock(l)	(pthread_mutex_trylock(&(l)->m) == 0)
+#define mutex_unlock(l)		pthread_mutex_unlock(&(l)->m)
+
+/*
+ * Time
+ */
+#define HZ	250
+
+static inline unsigned long shim_jiffies(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * HZ + ts.tv_nsec / (1000000000 / HZ);
+}
+
+#define jiffies			shim_jiffies()
+
+static inline u64 local_clock(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+#define time_after(a, b)	((long) ((b) - (a)) < 0)
+#define time_before(a, b)	time_after(b, a)
+#define time_after_eq(a, b)	((long) ((a) - (b)) >= 0)
+
+/*
+ * User copies
+ */
+static inline unsigned long copy_to_user(void *to, const void *from,
+					 unsigned long n)
+{
+	memcpy(to, from, n);
+	return 0;
+}
+
+static inline unsigned long copy_from_user(void *to, const void *from,
+					   unsigned long n)
+{
+	memcpy(to, from, n);
+	return 0;
+}
+
+struct iov_iter {
+	char *base;
+	size_t count;
+};
+
+static inline void shim_iov_iter(struct iov_iter *i, void *buf, size_t len)
+{
+	i->base		= buf;
+	i->count	= len;
+}
+
+static inline size_t iov_iter_count(const struct iov_iter *i)
+{
+	return i->count;
+}
+
+static inline void iov_iter_advance(struct iov_iter *i, size_t n)
+{
+	if (n > i->count)
+		n = i->count;
+	i->base		+= n;
+	i->count	-= n;
+}
+
+static inline size_t copy_to_iter(const void *from, size_t n,
+				  struct iov_iter *i)
+{
+	if (n > i->count)
+		n = i->count;
+	memcpy(i->base, from, n);
+	iov_iter_advance(i, n);
+	return n;
+}
+
+static inline size_t copy_from_iter(void *to, size_t n, struct iov_iter *i)
+{
+	if (n > i->count)
+		n = i->count;
+	memcpy(to, i->base, n);
+	iov_iter_advance(i, n);
+	return n;
+}
+
+/* The buffer is ours, so it is all there */
+static inline size_t fault_in_iov_iter_readable(const struct iov_iter *i,
+						size_t bytes)
+{
+	return 0;
+}
+
+/* CRC32C, a table at a time; the kernel's uses the CPU's instructions */
+static inline u32 crc32c(u32 crc, const void *p, size_t len)
+{
+	static u32 table[256];
+	const u8 *b = p;
+	int i, j;
+
+	if (!table[1]) {
+		for (i = 0; i < 256; i++) {
+			u32 c = i;
+
+			for (j = 0; j < 8; j++)
+				c = (c >> 1) ^ (c & 1 ? 0x82f63b78 : 0);
+			table[i] = c;
+		}
+	}
+	while (len--)
+		crc = (crc >> 8) ^ table[(crc ^ *b++) & 0xff];
+	return crc;
+}
+
+/*
+ * Wait queues: the condition is only tested with the mutex held, and
+ * wakers take the mutex, so a wakeup can't slip between test and sleep.
+ */
+typedef struct {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+} wait_queue_head_t;
+
+static inline void init_waitqueue_head(wait_queue_head_t *q)
+{
+	pthread_mutex_init(&q->lock, NULL);
+	pthread_cond_init(&q->cond, NULL);
+}
+
+#define wait_event_interruptible(wq, condition)				\
+({									\
+	pthread_mutex_lock(&(wq).lock);					\
+	while (!(condition))						\
+		pthread_cond_wait(&(wq).cond, &(wq).lock);		\
+	pthread_mutex_unlock(&(wq).lock);				\
+	0;								\
+})
+
+/* Wakers broadcast, so exclusive waits only differ in the herd they wake */
+#define wait_event_interruptible_exclusive(wq, condition)		\
+	wait_event_interruptible(wq, condition)
+
+static inline void wake_up_interruptible(wait_queue_head_t *q)
+{
+	pthread_mutex_lock(&q->lock);
+	pthread_cond_broadcast(&q->cond);
+	pthread_mutex_unlock(&q->lock);
+}
+
+/*
+ * Timers: a list of the pending ones
+ */
+struct timer_list {
+	struct timer_list *next, *prev;
+	unsigned long expires;
+	void (*function)(struct timer_list *);
+	int pending;
+};
+
+extern pthread_mutex_t shim_timer_lock;
+extern struct timer_list shim_timers;	/* list head */
+
+#define container_of(ptr, type, member)					\
+	((type *) ((char *) (ptr) - offsetof(type, member)))
+#define timer_container_of(var, t, field)				\
+	container_of(t, __typeof__(*(var)), field)
+
+static inline void timer_setup(struct timer_list *t,
+			       void (*fn)(struct timer_list *),
+			       unsigned int flags)
+{
+	t->next = t->prev = NULL;
+	t->function = fn;
+	t->pending = 0;
+}
+
+static inline void shim_timer_unlink(struct timer_list *t)
+{
+	t->prev->next = t->next;
+	t->next->prev = t->prev;
+	t->pending = 0;
+}
+
+static inline int mod_timer(struct timer_list *t, unsigned long expires)
+{
+	int was_pending;
+
+	pthread_mutex_lock(&shim_timer_lock);
+	was_pending = t->pending;
+	if (was_pending)
+		shim_timer_unlink(t);
+	t->expires	= expires;
+	t->next		= shim_timers.next;
+	t->prev		= &shim_timers;
+	shim_timers.next->prev = t;
+	shim_timers.next = t;
+	t->pending	= 1;
+	pthread_mutex_unlock(&shim_timer_lock);
+	return was_pending;
+}
+
+static inline void add_timer(struct timer_list *t)
+{
+	mod_timer(t, t->expires);
+}
+
+static inline int timer_delete_sync(struct timer_list *t)
+{
+	int was_pending;
+
+	pthread_mutex_lock(&shim_timer_lock);
+	was_pending = t->pending;
+	if (was_pending)
+		shim_timer_unlink(t);
+	pthread_mutex_unlock(&shim_timer_lock);
+	return was_pending;
+}
+
+#define timer_delete(t)	timer_delete_sync(t)
+
+/* Runs the expired timers; returns how many ran */
+int shim_run_timers(void);
+
+#endif /* _KSHIM_H */
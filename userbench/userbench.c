@@ -0,0 +1,189 @@
+/*
+ * userbench.c -- the microbenchmark runner, and the timer list of kshim.h
+ *
+ *	userbench [--min_time=seconds] [--check] [filter...]
+ *
+ * Runs every benchmark whose name contains one of the filters (all when
+ * none is given) and prints one line per benchmark. With --check, runs the
+ * checks instead, the same way, and exits non-zero at the first to fail.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "kshim.h"
+#include "userbench.h"
+
+/*
+ * kshim timers
+ */
+pthread_mutex_t shim_timer_lock = PTHREAD_MUTEX_INITIALIZER;
+struct timer_list shim_timers = {
+	.next	= &shim_timers,
+	.prev	= &shim_timers
+};
+
+int shim_run_timers(void)
+{
+	struct timer_list *t, *next;
+	unsigned long now = jiffies;
+	int ran = 0;
+
+	pthread_mutex_lock(&shim_timer_lock);
+	for (t = shim_timers.next; t != &shim_timers; t = next) {
+		next = t->next;
+		if (!time_after_eq(now, t->expires))
+			continue;
+		shim_timer_unlink(t);
+		/* the callback may re-arm, which takes the lock */
+		pthread_mutex_unlock(&shim_timer_lock);
+		t->function(t);
+		ran++;
+		pthread_mutex_lock(&shim_timer_lock);
+		next = shim_timers.next;	/* the list may have changed */
+	}
+	pthread_mutex_unlock(&shim_timer_lock);
+	return ran;
+}
+
+/*
+ * The runner
+ */
+#define MAX_BENCHMARKS	64
+
+static struct {
+	const char *name;
+	ub_fn fn;
+} benchmarks[MAX_BENCHMARKS];
+static int nr_benchmarks;
+
+static struct {
+	const char *name;
+	ub_test_fn fn;
+} tests[MAX_BENCHMARKS];
+static int nr_tests;
+
+void ub_register(const char *name, ub_fn fn)
+{
+	if (nr_benchmarks == MAX_BENCHMARKS) {
+		fprintf(stderr, "userbench: too many benchmarks\n");
+		exit(1);
+	}
+	benchmarks[nr_benchmarks].name	= name;
+	benchmarks[nr_benchmarks].fn	= fn;
+	nr_benchmarks++;
+}
+
+void ub_register_test(const char *name, ub_test_fn fn)
+{
+	if (nr_tests == MAX_BENCHMARKS) {
+		fprintf(stderr, "userbench: too many checks\n");
+		exit(1);
+	}
+	tests[nr_tests].name	= name;
+	tests[nr_tests].fn	= fn;
+	nr_tests++;
+}
+
+void ub_fail(const char *file, int line, const char *cond)
+{
+	fflush(stdout);
+	fprintf(stderr, "%s:%d: check failed: %s\n", file, line, cond);
+	exit(1);
+}
+
+static double now_s(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void run_one(const char *name, ub_fn fn, double min_time)
+{
+	struct ub_state st;
+	uint64_t iters = 1;
+	double t, mult;
+	char rate[32] = "";
+
+	for (;;) {
+		memset(&st, 0, sizeof(st));
+		st.iterations = st.remaining = iters;
+		t = now_s();
+		fn(&st);
+		t = now_s() - t;
+
+		if (t >= min_time || iters >= 1000000000ULL)
+			break;
+		/* aim a little past the minimum, growing at least 2x */
+		mult = t > 0 ? min_time * 1.4 / t : 10;
+		if (mult < 2)
+			mult = 2;
+		if (mult > 10)
+			mult = 10;
+		iters *= mult;
+	}
+
+	if (st.bytes)
+		snprintf(rate, sizeof(rate), "%10.1f MB/s",
+			 st.bytes / t / 1e6);
+	else if (st.items)
+		snprintf(rate, sizeof(rate), "%10.3f M/s",
+			 st.items / t / 1e6);
+	printf("%-40s %12.1f ns %14llu %s\n", name, t * 1e9 / iters,
+	       (unsigned long long) iters, rate);
+	fflush(stdout);
+}
+
+/* Whether name is picked by the filters left in argv */
+static int selected(const char *name, int argc, char **argv, int nr_filters)
+{
+	int j;
+
+	if (!nr_filters)
+		return 1;
+	for (j = 1; j < argc; j++)
+		if (argv[j] && strstr(name, argv[j]))
+			return 1;
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	double min_time = 0.5;
+	int i, j, nr_filters = 0, check = 0;
+
+	for (j = 1; j < argc; j++) {
+		if (!strncmp(argv[j], "--min_time=", 11)) {
+			min_time = atof(argv[j] + 11);
+			argv[j] = NULL;
+		} else if (!strcmp(argv[j], "--check")) {
+			check = 1;
+			argv[j] = NULL;
+		} else {
+			nr_filters++;
+		}
+	}
+
+	if (check) {
+		for (i = 0; i < nr_tests; i++) {
+			if (!selected(tests[i].name, argc, argv, nr_filters))
+				continue;
+			tests[i].fn();
+			printf("%-40s ok\n", tests[i].name);
+			fflush(stdout);
+		}
+		return 0;
+	}
+
+	printf("%-40s %15s %14s\n", "Benchmark", "Time", "Iterations");
+	for (i = 0; i < nr_benchmarks; i++)
+		if (selected(benchmarks[i].name, argc, argv, nr_filters))
+			run_one(benchmarks[i].name, benchmarks[i].fn,
+				min_time);
+	return 0;
+}
@@ -0,0 +1,91 @@
+/*
+ * userbench.h -- a small microbenchmark runner in the style of Google
+ * Benchmark, for the driver cores built against kshim.h
+ *
+ *	static void BM_thing(struct ub_state *st)
+ *	{
+ *		while (ub_keep_running(st))
+ *			thing();
+ *		ub_set_bytes(st, st->iterations * size);
+ *	}
+ *	BENCHMARK(BM_thing);
+ *
+ * The runner grows the iteration count until a run takes at least the
+ * minimum time, then reports time per iteration.
+ *
+ * Checks of what the cores do are registered the same way, and run with
+ * --check instead of the benchmarks:
+ *
+ *	static void CHECK_thing(void)
+ *	{
+ *		UB_CHECK(thing() == 0);
+ *	}
+ *	UB_TEST(CHECK_thing);
+ *
+ * A UB_CHECK() that fails ends the program, so benchmarks use it too, for
+ * what they take for granted.
+ */
+
+#ifndef _USERBENCH_H
+#define _USERBENCH_H
+
+#include <stdint.h>
+
+struct ub_state {
+	uint64_t iterations;	/* asked for by the runner */
+	uint64_t remaining;
+	uint64_t bytes;		/* processed in total, if it means anything */
+	uint64_t items;		/* ditto, for non-byte units */
+};
+
+static inline int ub_keep_running(struct ub_state *st)
+{
+	if (st->remaining) {
+		st->remaining--;
+		return 1;
+	}
+	return 0;
+}
+
+static inline void ub_set_bytes(struct ub_state *st, uint64_t bytes)
+{
+	st->bytes = bytes;
+}
+
+static inline void ub_set_items(struct ub_state *st, uint64_t items)
+{
+	st->items = items;
+}
+
+/* Keeps the compiler from optimising a value away */
+#define ub_do_not_optimize(v)	__asm__ __volatile__("" : : "r,m"(v) : "memory")
+
+typedef void (*ub_fn)(struct ub_state *st);
+
+void ub_register(const char *name, ub_fn fn);
+
+#define BENCHMARK(fn)							\
+	static void __attribute__((constructor)) ub_register_##fn(void)	\
+	{								\
+		ub_register(#fn, fn);					\
+	}
+
+typedef void (*ub_test_fn)(void);
+
+void ub_register_test(const char *name, ub_test_fn fn);
+void ub_fail(const char *file, int line, const char *cond)
+	__attribute__((noreturn));
+
+#define UB_TEST(fn)							\
+	static void __attribute__((constructor)) ub_register_##fn(void)	\
+	{								\
+		ub_register_test(#fn, fn);				\
+	}
+
+#define UB_CHECK(cond)							\
+	do {								\
+		if (!(cond))						\
+			ub_fail(__FILE__, __LINE__, #cond);		\
+	} while (0)
+
+#endif /* _USERBENCH_H */
@@ -3,7 +3,29 @@
  * get video ram address range from `/proc/iomem`
  *	0x000A0000 - 0x000BFFFF.
  *
- * User access is through the read and write calls.
+ * User access is through the read and write calls, which move data between
+ * the user buffer and video RAM `chunk_size` bytes at a time, through a
+ * bounce buffer.
+ *
+ * The aperture is split evenly between `num_devices` minors, /dev/vram0 and
+ * on, each serialised by its own lock; counters are in
+ * /sys/class/dd/vram<n>/stats, histograms in /sys/kernel/debug/dd/vram<n>.
+ *
+ * With `shadow`, each minor keeps a copy of its slice in RAM, which reads
+ * and writes go to instead, and a bitmap of the `tile_size` byte tiles
+ * written since they were last pushed to video RAM. A flush pushes each
+ * run of dirty tiles with a single memcpy_toio(), so the bus only carries
+ * what changed. Flushes happen on VRAM_IOC_FLUSH (see vram_ioctl.h), on
+ * fsync(), `flush_ms` after the first write since the last flush, if that
+ * is set, and on unload. /sys/class/dd/vram<n>/shadow counts them.
+ *
+ * Reading /proc/vram_bench, which only root may, measures how fast the
+ * aperture can be read and written, `bench_passes` times over, 8, 16, 32
+ * and 64 bits at a time and with memcpy_fromio()/memcpy_toio(); then the
+ * same again on a buffer in RAM, for what the accessors cost without the
+ * bus, and there also with non-temporal stores where the CPU has them. The
+ * devices wait while it runs, and what was on the screen is put back
+ * afterwards.
  */
 
 #include <linux/module.h>
@@ -16,17 +38,162 @@
 #include <linux/cdev.h>
 #include <linux/uaccess.h>
 #include <linux/io.h>
+#include <linux/slab.h>
+#include <linux/mutex.h>
+#include <linux/cache.h>	/* ____cacheline_aligned_in_smp */
+#include <linux/vmalloc.h>
+#include <linux/bitmap.h>
+#include <linux/log2.h>
+#include <linux/workqueue.h>
+#include <linux/jiffies.h>
+#include <linux/proc_fs.h>
+#include <linux/seq_file.h>
+#include <linux/string.h>	/* memcpy_flushcache() */
+#include <linux/math64.h>	/* div64_u64() */
+#include <linux/sched.h>	/* cond_resched() */
+
+#include "dd_compat.h"
+#include "dd_core.h"
+#include "dd_param.h"
+#include "vram_ioctl.h"
 
 #define VRAM_BASE 0x000A0000
 #define VRAM_SIZE 0x00020000
 
+static int num_devices = 1;	/* minors sharing the aperture */
+module_param(num_devices, int, 0444);
+
 static void __iomem *vram;
-static dev_t first;
-static struct cdev c_dev;
-static struct class *c1;
+
+static int chunk_size = PAGE_SIZE;	/* bytes per bounce buffer copy */
+
+DD_PARAM(chunk_size, int, 1, VRAM_SIZE, NULL);
+
+static bool shadow;		/* write to RAM, flush dirty tiles to vram */
+module_param(shadow, bool, 0444);
+
+static unsigned int tile_size = L1_CACHE_BYTES;	/* a power of two */
+module_param(tile_size, uint, 0444);
+
+static int flush_ms;		/* after a write; 0: only when asked to */
+
+DD_PARAM(flush_ms, int, 0, 60 * MSEC_PER_SEC, NULL);
+
+static int bench_passes = 64;	/* over the aperture, per access method */
+
+DD_PARAM(bench_passes, int, 1, 100000, NULL);
+
+/* One per minor: a slice of the aperture, on cache lines of its own */
+struct vr_dev {
+	struct mutex lock;		/* one transfer at a time */
+	void __iomem *base;
+	size_t size;
+	unsigned long reads, writes;	/* under lock */
+	u64 bytes_read, bytes_written;
+
+	/* with shadow, all under lock */
+	u8 *shadow;			/* what the slice will hold */
+	unsigned long *dirty;		/* tiles not pushed since written */
+	unsigned long tiles;
+	struct delayed_work flush_work;
+	unsigned long flushes;
+	u64 bytes_flushed;
+} ____cacheline_aligned_in_smp;
+
+/*
+ * The shadow
+ */
+
+/* Marks the tiles bytes [off, off + len) are in */
+static void vr_mark_dirty(struct vr_dev *vd, size_t off, size_t len)
+{
+	unsigned int shift = ilog2(tile_size);
+	unsigned long first = off >> shift;
+	unsigned long last = (off + len - 1) >> shift;
+	int ms = READ_ONCE(flush_ms);
+
+	if (!len)
+		return;
+	bitmap_set(vd->dirty, first, last - first + 1);
+	/* already pending from an earlier write, it stays as it is */
+	if (ms)
+		schedule_delayed_work(&vd->flush_work, msecs_to_jiffies(ms));
+}
+
+/* Pushes every run of dirty tiles to video RAM; returns the bytes pushed */
+static size_t vr_flush_locked(struct vr_dev *vd)
+{
+	unsigned int shift = ilog2(tile_size);
+	unsigned long start, end;
+	size_t off, len, bytes = 0;
+
+	for (start = find_first_bit(vd->dirty, vd->tiles); start < vd->tiles;
+	     start = find_next_bit(vd->dirty, vd->tiles, end)) {
+		end = find_next_zero_bit(vd->dirty, vd->tiles, start);
+		off = start << shift;
+		len = min_t(size_t, (end - start) << shift, vd->size - off);
+		memcpy_toio(vd->base + off, vd->shadow + off, len);
+		bitmap_clear(vd->dirty, start, end - start);
+		bytes += len;
+	}
+	vd->flushes++;
+	vd->bytes_flushed += bytes;
+	return bytes;
+}
+
+static size_t vr_flush(struct vr_dev *vd)
+{
+	size_t bytes;
+
+	mutex_lock(&vd->lock);
+	bytes = vr_flush_locked(vd);
+	mutex_unlock(&vd->lock);
+	return bytes;
+}
+
+static void vr_flush_work(struct work_struct *work)
+{
+	vr_flush(container_of(to_delayed_work(work), struct vr_dev,
+			      flush_work));
+}
+
+static ssize_t vr_shadow_read(struct vr_dev *vd, char __user *buf,
+			      size_t len, loff_t off)
+{
+	mutex_lock(&vd->lock);
+	if (copy_to_user(buf, vd->shadow + off, len)) {
+		mutex_unlock(&vd->lock);
+		return -EFAULT;
+	}
+	vd->reads++;
+	vd->bytes_read += len;
+	mutex_unlock(&vd->lock);
+	return len;
+}
+
+static ssize_t vr_shadow_write(struct vr_dev *vd, const char __user *buf,
+			       size_t len, loff_t off)
+{
+	size_t left;
+
+	mutex_lock(&vd->lock);
+	left = copy_from_user(vd->shadow + off, buf, len);
+	/* whatever did get copied still has to go out */
+	vr_mark_dirty(vd, off, len - left);
+	if (left) {
+		mutex_unlock(&vd->lock);
+		return -EFAULT;
+	}
+	vd->writes++;
+	vd->bytes_written += len;
+	mutex_unlock(&vd->lock);
+	return len;
+}
 
 static int vr_open(struct inode *inode, struct file *file)
 {
+	file->private_data = dd_chrdev_priv(inode);
+	dd_stat_inc(dd_file_stats(file), DD_OPENS);
 	return 0;
 }
 
@@ -35,93 +202,496 @@ static int vr_close(struct inode *inode, struct file *file)
 	return 0;
 }
 
-static ssize_t vr_read(struct file *filp, char __user *buf, size_t len,
-		       loff_t *off)
+static ssize_t vr_do_read(struct file *filp, char __user *buf, size_t len,
+			  loff_t *off)
 {
-	int i;
-	u8 byte;
+	struct vr_dev *vd = filp->private_data;
+	size_t chunk = READ_ONCE(chunk_size);
+	size_t done, n;
+	u8 *bounce;
 
-	if (*off >= VRAM_SIZE)
+	if (*off >= vd->size)
 		return 0;
-	if (*off + len > VRAM_SIZE)
-		len = VRAM_SIZE - *off;
-	for (i = 0; i < len; i++) {
-		byte = ioread8((u8 *)vram + *off + i);
-		if (copy_to_user(buf + 1, &byte, 1))
+	if (*off + len > vd->size)
+		len = vd->size - *off;
+
+	if (vd->shadow) {
+		ssize_t ret = vr_shadow_read(vd, buf, len, *off);
+
+		if (ret > 0)
+			*off += ret;
+		return ret;
+	}
+
+	bounce = kmalloc(min(chunk, len), GFP_KERNEL);
+	if (!bounce)
+		return -ENOMEM;
+	mutex_lock(&vd->lock);
+	for (done = 0; done < len; done += n) {
+		n = min(chunk, len - done);
+		memcpy_fromio(bounce, vd->base + *off + done, n);
+		if (copy_to_user(buf + done, bounce, n)) {
+			mutex_unlock(&vd->lock);
+			kfree(bounce);
 			return -EFAULT;
+		}
 	}
+	vd->reads++;
+	vd->bytes_read += len;
+	mutex_unlock(&vd->lock);
+	kfree(bounce);
 	*off += len;
 
 	return len;
 }
 
-static ssize_t vr_write(struct file *filp, const char __user *buf, size_t len,
-			loff_t *off)
+static ssize_t vr_do_write(struct file *filp, const char __user *buf,
+			   size_t len, loff_t *off)
 {
-	int i;
-	u8 byte;
+	struct vr_dev *vd = filp->private_data;
+	size_t chunk = READ_ONCE(chunk_size);
+	size_t done, n;
+	u8 *bounce;
 
-	if (*off >= VRAM_SIZE)
+	if (*off >= vd->size)
 		return 0;
-	if (*off + len > VRAM_SIZE)
-		len = VRAM_SIZE - *off;
+	if (*off + len > vd->size)
+		len = vd->size - *off;
+
+	if (vd->shadow) {
+		ssize_t ret = vr_shadow_write(vd, buf, len, *off);
+
+		if (ret > 0)
+			*off += ret;
+		return ret;
+	}
 
-	for (i = 0; i < len; i++) {
-		if (copy_from_user(&byte, buf + i, 1))
+	bounce = kmalloc(min(chunk, len), GFP_KERNEL);
+	if (!bounce)
+		return -ENOMEM;
+	mutex_lock(&vd->lock);
+	for (done = 0; done < len; done += n) {
+		n = min(chunk, len - done);
+		if (copy_from_user(bounce, buf + done, n)) {
+			mutex_unlock(&vd->lock);
+			kfree(bounce);
 			return -EFAULT;
-		iowrite8(byte, (u8 *)vram + *off + i);
+		}
+		memcpy_toio(vd->base + *off + done, bounce, n);
 	}
+	vd->writes++;
+	vd->bytes_written += len;
+	mutex_unlock(&vd->lock);
+	kfree(bounce);
 	*off += len;
 
 	return len;
 }
 
+static ssize_t vr_read(struct file *filp, char __user *buf, size_t len,
+		       loff_t *off)
+{
+	u64 t0 = ktime_get_ns();
+	ssize_t ret = vr_do_read(filp, buf, len, off);
+
+	dd_stat_io(dd_file_stats(filp), DD_READS, ret, t0);
+	return ret;
+}
+
+static ssize_t vr_write(struct file *filp, const char __user *buf, size_t len,
+			loff_t *off)
+{
+	u64 t0 = ktime_get_ns();
+	ssize_t ret = vr_do_write(filp, buf, len, off);
+
+	dd_stat_io(dd_file_stats(filp), DD_WRITES, ret, t0);
+	return ret;
+}
+
+/* Without a shadow, writes go straight out and there is nothing to do */
+static int vr_fsync(struct file *filp, loff_t start, loff_t end,
+		    int datasync)
+{
+	struct vr_dev *vd = filp->private_data;
+
+	if (vd->shadow)
+		vr_flush(vd);
+	return 0;
+}
+
+static long vr_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
+{
+	struct vr_dev *vd = filp->private_data;
+
+	switch (cmd) {
+	case VRAM_IOC_FLUSH:
+		return vd->shadow ? vr_flush(vd) : 0;
+	default:
+		return -ENOTTY;
+	}
+}
+
 static struct file_operations vram_fops = {
 	.owner		= THIS_MODULE,
 	.open		= vr_open,
 	.release	= vr_close,
 	.read		= vr_read,
-	.write		= vr_write
+	.write		= vr_write,
+	.fsync		= vr_fsync,
+	.unlocked_ioctl	= vr_ioctl,
+	.compat_ioctl	= compat_ptr_ioctl
 };
 
-static int __init vr_init(void)
+/* /sys/class/dd/vram<n>/stats */
+static ssize_t stats_show(struct device *dev, struct device_attribute *attr,
+			  char *buf)
 {
-	if ((vram = ioremap(VRAM_BASE, VRAM_SIZE)) == NULL) {
-		pr_err("Mapping video RAM failed\n");
-		return -1;
+	struct vr_dev *vd = dev_get_drvdata(dev);
+	ssize_t n;
+
+	mutex_lock(&vd->lock);
+	n = scnprintf(buf, PAGE_SIZE, "reads %lu writes %lu bytes_read %llu "
+		      "bytes_written %llu\n", vd->reads, vd->writes,
+		      vd->bytes_read, vd->bytes_written);
+	mutex_unlock(&vd->lock);
+	return n;
+}
+static DEVICE_ATTR_RO(stats);
+
+/* /sys/class/dd/vram<n>/shadow */
+static ssize_t shadow_show(struct device *dev, struct device_attribute *attr,
+			   char *buf)
+{
+	struct vr_dev *vd = dev_get_drvdata(dev);
+	ssize_t n;
+
+	if (!vd->shadow)
+		return scnprintf(buf, PAGE_SIZE, "none\n");
+	mutex_lock(&vd->lock);
+	n = scnprintf(buf, PAGE_SIZE, "tile_size %u tiles %lu dirty %u "
+		      "flushes %lu bytes_flushed %llu\n", tile_size, vd->tiles,
+		      bitmap_weight(vd->dirty, vd->tiles), vd->flushes,
+		      vd->bytes_flushed);
+	mutex_unlock(&vd->lock);
+	return n;
+}
+static DEVICE_ATTR_RO(shadow);
+
+static struct attribute *vr_attrs[] = {
+	&dev_attr_stats.attr,
+	&dev_attr_shadow.attr,
+	NULL
+};
+ATTRIBUTE_GROUPS(vr);
+
+static int vr_setup(void *priv, int minor)
+{
+	struct vr_dev *vd = priv;
+	size_t slice = VRAM_SIZE / num_devices;
+
+	mutex_init(&vd->lock);
+	vd->base = vram + minor * slice;
+	vd->size = slice;
+	if (!shadow)
+		return 0;
+
+	/* starting out as what is on the screen, with nothing to push */
+	vd->tiles = DIV_ROUND_UP(slice, tile_size);
+	vd->shadow = vmalloc(slice);
+	vd->dirty = kcalloc(BITS_TO_LONGS(vd->tiles), sizeof(long),
+			    GFP_KERNEL);
+	if (!vd->shadow || !vd->dirty) {
+		vfree(vd->shadow);
+		kfree(vd->dirty);
+		vd->shadow = NULL;
+		return -ENOMEM;
 	}
+	memcpy_fromio(vd->shadow, vd->base, slice);
+	INIT_DELAYED_WORK(&vd->flush_work, vr_flush_work);
+	return 0;
+}
+
+/* Whatever is still dirty goes out before the shadow goes away */
+static void vr_teardown(void *priv, int minor)
+{
+	struct vr_dev *vd = priv;
+
+	if (!vd->shadow)
+		return;
+	cancel_delayed_work_sync(&vd->flush_work);
+	vr_flush(vd);
+	vfree(vd->shadow);
+	kfree(vd->dirty);
+	vd->shadow = NULL;
+}
+
+/*
+ * Access width benchmark : /proc/vram_bench
+ */
+
+#define VR_BENCH_WIDTH(_bits, _type, _read, _write)			\
+static void vr_read##_bits(void *dst, const void __iomem *src, size_t n)\
+{									\
+	_type *d = dst;							\
+	size_t i;							\
+									\
+	for (i = 0; i < n / sizeof(_type); i++)				\
+		d[i] = _read(src + i * sizeof(_type));			\
+}									\
+									\
+static void vr_write##_bits(void __iomem *dst, const void *src, size_t n)\
+{									\
+	const _type *s = src;						\
+	size_t i;							\
+									\
+	for (i = 0; i < n / sizeof(_type); i++)				\
+		_write(s[i], dst + i * sizeof(_type));			\
+}
+
+VR_BENCH_WIDTH(8, u8, readb, writeb)
+VR_BENCH_WIDTH(16, u16, readw, writew)
+VR_BENCH_WIDTH(32, u32, readl, writel)
+#ifdef CONFIG_64BIT
+VR_BENCH_WIDTH(64, u64, readq, writeq)
+#endif
+
+static void vr_read_memcpy(void *dst, const void __iomem *src, size_t n)
+{
+	memcpy_fromio(dst, src, n);
+}
+
+static void vr_write_memcpy(void __iomem *dst, const void *src, size_t n)
+{
+	memcpy_toio(dst, src, n);
+}
 
-	if (alloc_chrdev_region(&first, 0, 1, "vram") < 0)
-		return -1;
+#ifdef __HAVE_ARCH_MEMCPY_FLUSHCACHE
+/*
+ * movnti and the like; there are no non-temporal loads to go with them.
+ * RAM only: the aperture is mapped uncached, where they gain nothing.
+ */
+static void vr_write_nt(void __iomem *dst, const void *src, size_t n)
+{
+	memcpy_flushcache((void __force *) dst, src, n);
+}
+#endif
+
+struct vr_bench_method {
+	const char *name;
+	void (*read)(void *dst, const void __iomem *src, size_t n);
+	void (*write)(void __iomem *dst, const void *src, size_t n);
+	bool ram_only;
+};
 
-	if ((c1 = class_create(THIS_MODULE, "chardrv")) == NULL) {
-		unregister_chrdev_region(first, 1);
-		return -1;
+static const struct vr_bench_method vr_bench_methods[] = {
+	{ "8bit",	vr_read8,	vr_write8 },
+	{ "16bit",	vr_read16,	vr_write16 },
+	{ "32bit",	vr_read32,	vr_write32 },
+#ifdef CONFIG_64BIT
+	{ "64bit",	vr_read64,	vr_write64 },
+#endif
+	{ "memcpy_io",	vr_read_memcpy,	vr_write_memcpy },
+#ifdef __HAVE_ARCH_MEMCPY_FLUSHCACHE
+	{ "nt_store",	NULL,		vr_write_nt,	true },
+#endif
+};
+
+/* video RAM, then plain RAM */
+#define VR_BENCH_LINES		(2 * ARRAY_SIZE(vr_bench_methods))
+
+static DEFINE_MUTEX(vr_bench_mutex);	/* one run at a time */
+
+static struct dd_chrdev vr_chrdev;
+
+/*
+ * A run overwrites the whole aperture, so every minor's lock is held from
+ * before the screen is saved to after it is put back: no write, and no
+ * flush of a shadow, lands in between to be lost
+ */
+static void vr_bench_lock_devices(void)
+{
+	struct vr_dev *vd;
+	int i;
+
+	for (i = 0; i < vr_chrdev.count; i++) {
+		vd = vr_chrdev.minors[i].priv;
+		mutex_lock_nest_lock(&vd->lock, &vr_bench_mutex);
 	}
+}
 
-	if (device_create(c1, NULL, first, NULL, "vram") == NULL) {
-		class_destroy(c1);
-		unregister_chrdev_region(first, 1);
-		return -1;
+static void vr_bench_unlock_devices(void)
+{
+	struct vr_dev *vd;
+	int i;
+
+	for (i = vr_chrdev.count - 1; i >= 0; i--) {
+		vd = vr_chrdev.minors[i].priv;
+		mutex_unlock(&vd->lock);
 	}
+}
 
-	cdev_init(&c_dev, &vram_fops);
-	if (cdev_add(&c_dev, first, 1) == -1) {
-		device_destroy(c1, first);
-		class_destroy(c1);
-		unregister_chrdev_region(first, 1);
-		return -1;
+/* MB/s of bench_passes runs of m over the aperture-sized region at base */
+static u64 vr_bench_run(const struct vr_bench_method *m, int write,
+			void __iomem *base, void *buf)
+{
+	int passes = READ_ONCE(bench_passes);
+	u64 t0, ns;
+	int i;
+
+	t0 = ktime_get_ns();
+	for (i = 0; i < passes; i++) {
+		if (write)
+			m->write(base, buf, VRAM_SIZE);
+		else
+			m->read(buf, base, VRAM_SIZE);
+		cond_resched();
 	}
+	ns = ktime_get_ns() - t0;
+	/* a byte per ns is 1000 MB/s */
+	return div64_u64((u64) passes * VRAM_SIZE * 1000, ns ? ns : 1);
+}
 
-	return 0;
+static void *vr_bench_seq_start(struct seq_file *s, loff_t *pos)
+{
+	if (*pos == 0)
+		return SEQ_START_TOKEN;
+	if (*pos > VR_BENCH_LINES)
+		return NULL;
+	/* line n is n + 2, clear of SEQ_START_TOKEN and of NULL */
+	return (void *) (uintptr_t) (*pos + 1);
+}
+
+static void *vr_bench_seq_next(struct seq_file *s, void *v, loff_t *pos)
+{
+	++(*pos);
+	return vr_bench_seq_start(s, pos);
+}
+
+static void vr_bench_seq_stop(struct seq_file *s, void *v)
+{
+}
+
+/* One line per target and method: read and write bandwidth */
+static int vr_bench_seq_show(struct seq_file *s, void *v)
+{
+	unsigned long line = (uintptr_t) v - 2;
+	const struct vr_bench_method *m;
+	bool ram = line >= ARRAY_SIZE(vr_bench_methods);
+	void *buf, *save = NULL, *standin = NULL;
+	void __iomem *base;
+	u64 rd = 0, wr;
+	int ret = 0;
+
+	if (v == SEQ_START_TOKEN) {
+		seq_printf(s, "%-6s %-10s %10s %10s\n", "target", "access",
+			   "read MB/s", "write MB/s");
+		return 0;
+	}
+	m = &vr_bench_methods[line % ARRAY_SIZE(vr_bench_methods)];
+	if (m->ram_only && !ram)
+		return SEQ_SKIP;
+
+	buf = vmalloc(VRAM_SIZE);
+	if (ram)
+		standin = vzalloc(VRAM_SIZE);
+	else
+		save = vmalloc(VRAM_SIZE);
+	if (!buf || !(ram ? standin : save)) {
+		ret = -ENOMEM;
+		goto out;
+	}
+	memset(buf, 0x5a, VRAM_SIZE);
+	base = ram ? (void __force __iomem *) standin : vram;
+
+	mutex_lock(&vr_bench_mutex);
+	if (save) {
+		vr_bench_lock_devices();
+		memcpy_fromio(save, vram, VRAM_SIZE);
+	}
+	if (m->read)
+		rd = vr_bench_run(m, 0, base, buf);
+	wr = vr_bench_run(m, 1, base, buf);
+	if (save) {
+		memcpy_toio(vram, save, VRAM_SIZE);
+		vr_bench_unlock_devices();
+	}
+	mutex_unlock(&vr_bench_mutex);
+
+	seq_printf(s, "%-6s %-10s ", ram ? "ram" : "vram", m->name);
+	if (m->read)
+		seq_printf(s, "%10llu %10llu\n", rd, wr);
+	else
+		seq_printf(s, "%10s %10llu\n", "-", wr);
+out:
+	vfree(save);
+	vfree(standin);
+	vfree(buf);
+	return ret;
+}
+
+static struct seq_operations vr_bench_seq_ops = {
+	.start	= vr_bench_seq_start,
+	.next	= vr_bench_seq_next,
+	.stop	= vr_bench_seq_stop,
+	.show	= vr_bench_seq_show
+};
+
+static int vr_bench_proc_open(struct inode *inode, struct file *file)
+{
+	return seq_open(file, &vr_bench_seq_ops);
+}
+
+static const struct dd_proc_ops vr_bench_proc_ops = {
+	DD_PROC_OPS(vr_bench_proc_open, seq_read, NULL, seq_lseek,
+		    seq_release)
+};
+
+static const struct dd_proc vr_procs[] = {
+	{ "vram_bench",	0400,	&vr_bench_proc_ops,	NULL },
+};
+
+static struct dd_chrdev vr_chrdev = {
+	.name		= "vram",
+	.node		= "vram%d",
+	.fops		= &vram_fops,
+	.groups		= vr_groups,
+	.priv_size	= sizeof(struct vr_dev),
+	.setup		= vr_setup,
+	.teardown	= vr_teardown
+};
+
+static int __init vr_init(void)
+{
+	int ret;
+
+	if (num_devices < 1 || num_devices > VRAM_SIZE / PAGE_SIZE)
+		return -EINVAL;
+	if (!is_power_of_2(tile_size) || tile_size > PAGE_SIZE)
+		return -EINVAL;
+
+	if ((vram = ioremap(VRAM_BASE, VRAM_SIZE)) == NULL) {
+		pr_err("Mapping video RAM failed\n");
+		return -ENOMEM;
+	}
+
+	vr_chrdev.count = num_devices;
+	ret = dd_chrdev_register(&vr_chrdev);
+	if (ret) {
+		iounmap(vram);
+		return ret;
+	}
+	ret = DD_PROC_REGISTER(vr_procs);
+	if (ret) {
+		dd_chrdev_unregister(&vr_chrdev);
+		iounmap(vram);
+	}
+	return ret;
 }
 
 static void __exit vr_exit(void)
 {
-	cdev_del(&c_dev);
-	device_destroy(c1, first);
-	class_destroy(c1);
-	unregister_chrdev_region(first, 1);
+	DD_PROC_UNREGISTER(vr_procs);
+	dd_chrdev_unregister(&vr_chrdev);
 	iounmap(vram);
 }
 
@@ -0,0 +1,21 @@
+/*
+ * vram_ioctl.h -- what user space needs to talk to vid_ram_ex
+ *
+ * With `shadow`, writes land in a copy of the minor's slice in RAM and
+ * only the tiles they dirtied reach video RAM, when flushed: by
+ * VRAM_IOC_FLUSH, by fsync(), or `flush_ms` after the first write since
+ * the last flush. VRAM_IOC_FLUSH returns how many bytes it pushed.
+ *
+ *	write(fd, sprite, len) ...
+ *	ioctl(fd, VRAM_IOC_FLUSH);
+ */
+
+#ifndef _VRAM_IOCTL_H
+#define _VRAM_IOCTL_H
+
+#include <linux/ioctl.h>
+
+#define VRAM_IOC_MAGIC		'V'
+#define VRAM_IOC_FLUSH		_IO(VRAM_IOC_MAGIC, 1)
+
+#endif /* _VRAM_IOCTL_H */